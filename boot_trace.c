@@ -0,0 +1,59 @@
+/*
+ * boot_trace.c
+ *
+ *  Boot stage trace ring, see boot_trace.h.
+ */
+
+#include <string.h>
+#include "chip.h"
+#include "boot_trace.h"
+
+static boot_trace_ring_t boot_trace_ring __attribute__((section(".noinit")));
+
+void
+boot_trace_init(void)
+{
+    if (boot_trace_ring.magic != BOOT_TRACE_MAGIC) {
+        boot_trace_ring.head = 0;
+        boot_trace_ring.magic = BOOT_TRACE_MAGIC;
+    }
+}
+
+void
+boot_trace(uint32_t id, uint32_t arg)
+{
+    boot_trace_rec_t *r = &boot_trace_ring.rec[boot_trace_ring.head & (BOOT_TRACE_RECORDS - 1)];
+
+    r->cycle = (uint32_t)__get_rv_cycle();
+    r->id = id;
+    r->arg = arg;
+    boot_trace_ring.head++;
+}
+
+uint32_t
+boot_trace_head(void)
+{
+    return boot_trace_ring.head;
+}
+
+uint32_t
+boot_trace_read(uint32_t seq, uint32_t *buf, uint32_t max_bytes)
+{
+    uint32_t head = boot_trace_ring.head;
+    uint32_t bytes = sizeof(uint32_t);
+
+    if ((int32_t)(head - seq) < 0) {
+        seq = head;
+    } else if (head - seq > BOOT_TRACE_RECORDS) {
+        seq = head - BOOT_TRACE_RECORDS;
+    }
+    buf[0] = seq;
+
+    while (seq != head && bytes + sizeof(boot_trace_rec_t) <= max_bytes) {
+        memcpy((uint8_t *)buf + bytes, &boot_trace_ring.rec[seq & (BOOT_TRACE_RECORDS - 1)], sizeof(boot_trace_rec_t));
+        bytes += sizeof(boot_trace_rec_t);
+        seq++;
+    }
+
+    return bytes;
+}
@@ -148,7 +148,9 @@ static void crypto_aes_process_ccm_aad(CRYPTO_RESOURCES *crypto, uint8_t * p_sou
     crypto->info->cb_event(CSK_CRYPTO_EVENT_WAIT_DONE, CSK_DRIVER_OK, (void*)crypto);
 }
 
-static void crypto_aes_process(CRYPTO_RESOURCES *crypto, const uint32_t * p_source,
+// program one segment and start the engine, returns 0 if the segment was finished
+// here already (CCM AAD), else the DONE event arrives from crypto_aes_irq_handler
+static uint8_t crypto_aes_kick(CRYPTO_RESOURCES *crypto, const uint32_t * p_source,
         uint32_t num_bytes, uint32_t * p_dest, uint8_t start)
 {
     uint32_t out_length = num_bytes;
@@ -180,7 +182,7 @@ static void crypto_aes_process(CRYPTO_RESOURCES *crypto, const uint32_t * p_sour
             {
                 // process AAD data for CCM mode
                 crypto_aes_process_ccm_aad(crypto, (uint8_t*)p_source, num_bytes, p_dest);
-                return;
+                return 0;
             }
             else
             {
@@ -224,7 +226,14 @@ static void crypto_aes_process(CRYPTO_RESOURCES *crypto, const uint32_t * p_sour
         crypto_config_dma(crypto, p_source, num_bytes, p_dest);
     }
 
-    crypto->info->cb_event(CSK_CRYPTO_EVENT_WAIT_DONE, CSK_DRIVER_OK, (void*)crypto);
+    return 1;
+}
+
+static void crypto_aes_process(CRYPTO_RESOURCES *crypto, const uint32_t * p_source,
+        uint32_t num_bytes, uint32_t * p_dest, uint8_t start)
+{
+    if(crypto_aes_kick(crypto, p_source, num_bytes, p_dest, start))
+        crypto->info->cb_event(CSK_CRYPTO_EVENT_WAIT_DONE, CSK_DRIVER_OK, (void*)crypto);
 }
 
 
@@ -300,6 +309,40 @@ CRYPTO_AES_Decrypt (void* res, const uint32_t * p_source,
     return crypto_aes_start(res, p_source, num_bytes, p_dest, 0);
 }
 
+// start decrypting one DMA segment and return at once, only whole blocks without
+// AAD qualify so the irq handler has nothing to chain. The buffers must stay
+// untouched until CRYPTO_AES_Wait()
+int32_t
+CRYPTO_AES_Decrypt_Start (void* res, const uint32_t * p_source,
+                    uint32_t num_bytes, uint32_t * p_dest)
+{
+    CHECK_RESOURCES(res);
+
+    CRYPTO_RESOURCES* crypto = (CRYPTO_RESOURCES*)res;
+
+    if(num_bytes == 0 || num_bytes % CRYPTO_AES_BLOCK_SIZE ||
+            (crypto->aes_info->aad_len > 0 && crypto->aes_info->aad_flag == 0))
+        return CSK_DRIVER_ERROR_PARAMETER;
+
+    crypto->aes_info->last_len = 0;
+    crypto->aes_reg->REG_AES_MSG_CFG.bit.AES_ENCRYPT = 0;
+
+    crypto_aes_kick(crypto, p_source, num_bytes, p_dest, 1);
+
+    return CSK_DRIVER_OK;
+}
+
+// wait for the segment given to CRYPTO_AES_Decrypt_Start()
+int32_t
+CRYPTO_AES_Wait (void* res)
+{
+    CHECK_RESOURCES(res);
+
+    CRYPTO_RESOURCES* crypto = (CRYPTO_RESOURCES*)res;
+
+    return crypto->info->cb_event(CSK_CRYPTO_EVENT_WAIT_DONE, CSK_DRIVER_OK, (void*)crypto);
+}
+
 int32_t
 CRYPTO_AES_Decrypt_Flash (void* res, uint32_t flash_addr, uint32_t * p_source,
                     uint32_t num_bytes, uint32_t * p_dest)
@@ -14,11 +14,9 @@ static const uint8_t crypto_sha_size[] = {0x14, 0x1c, 0x20, 0x30, 0x40};
 static const uint8_t crypto_sha_mode[] = {HSU_MODE_SHA_1, HSU_MODE_SHA_224, HSU_MODE_SHA_256, HSU_MODE_SHA_384, HSU_MODE_SHA_512};
 static const uint8_t crypto_hmac_mode[] = {HSU_MODE_HMAC_SHA1, HSU_MODE_HMAC_SHA224, HSU_MODE_HMAC_SHA256, HSU_MODE_HMAC_SHA384, HSU_MODE_HMAC_SHA512};
 
-static int32_t crypto_sha_start(CRYPTO_RESOURCES *crypto, const uint32_t * p_source, uint32_t num_bytes, uint32_t *p_dest)
+// program one buffer and start the engine, the DONE event arrives from crypto_sha_irq_handler
+static void crypto_sha_kick(CRYPTO_RESOURCES *crypto, const uint32_t * p_source, uint32_t num_bytes, uint32_t last)
 {
-    uint32_t res = CSK_CRYPTO_EVENT_DONE;
-    int length = crypto_sha_size[crypto->sha_info->mode-1];
-
     LOGD("[%s]: num_bytes=%d\r\n", __func__,
             num_bytes);
 
@@ -30,12 +28,14 @@ static int32_t crypto_sha_start(CRYPTO_RESOURCES *crypto, const uint32_t * p_sou
     crypto->hsu_reg->REG_STATUS_CLEAR.bit.DONE_CLEAR = 1;
     //hsu_control_set(ctrl);
     //crypto->hsu_reg->REG_CONTROL.bit.MODE = crypto_sha_mode[crypto->sha_info->mode-1];
-    if(p_dest != NULL)
-        crypto->hsu_reg->REG_CONTROL.bit.LAST_BUFFER = 1;
-    else
-        crypto->hsu_reg->REG_CONTROL.bit.LAST_BUFFER = 0;
+    crypto->hsu_reg->REG_CONTROL.bit.LAST_BUFFER = last ? 1 : 0;
     crypto->hsu_reg->REG_IRQ_CTRL_EN.bit.CRYPTO_IRQ_EN = 1;
     crypto->hsu_reg->REG_CONTROL.bit.START = 1;
+}
+
+static int32_t crypto_sha_start(CRYPTO_RESOURCES *crypto, const uint32_t * p_source, uint32_t num_bytes, uint32_t *p_dest)
+{
+    crypto_sha_kick(crypto, p_source, num_bytes, p_dest != NULL);
     //hsu_wait_done(HSU_DONE_SET_SHA_BIT, false);
     crypto->info->cb_event(CSK_CRYPTO_EVENT_WAIT_DONE, CSK_DRIVER_OK, NULL);
 
@@ -76,6 +76,44 @@ CRYPTO_Hash (void* res, const uint32_t * p_source,
 }
 
 
+// start hashing one more buffer (a multiple of the block size) and return at once,
+// the source must stay untouched until CRYPTO_Hash_Wait() and the digest is read
+// out by a final CRYPTO_Hash(..., p_dest, 1)
+int32_t
+CRYPTO_Hash_Start (void* res, const uint32_t * p_source,
+            uint32_t num_bytes, uint32_t update)
+{
+    CHECK_RESOURCES(res);
+
+    CRYPTO_RESOURCES* crypto = (CRYPTO_RESOURCES*)res;
+
+    if(!update)
+    {
+        crypto->hsu_reg->REG_CONTROL.bit.FIRST_BUFFER = 1;
+        crypto->hsu_reg->REG_CONTROL.bit.MODE = crypto_sha_mode[crypto->sha_info->mode-1];
+    }
+    else
+    {
+        crypto->hsu_reg->REG_CONTROL.bit.FIRST_BUFFER = 0;
+    }
+
+    crypto_sha_kick(crypto, p_source, num_bytes, 0);
+
+    return CSK_DRIVER_OK;
+}
+
+// wait for the buffer given to CRYPTO_Hash_Start()
+int32_t
+CRYPTO_Hash_Wait (void* res)
+{
+    CHECK_RESOURCES(res);
+
+    CRYPTO_RESOURCES* crypto = (CRYPTO_RESOURCES*)res;
+
+    return crypto->info->cb_event(CSK_CRYPTO_EVENT_WAIT_DONE, CSK_DRIVER_OK, NULL);
+}
+
+
 // hmac functions, call CRYPTO_Hash for more data
 int32_t
 CRYPTO_HMAC (void* res, const uint32_t * p_source, uint32_t num_bytes,
@@ -9,6 +9,7 @@
 #include "crypto.h"
 #include "ota.h"
 #include "Driver_CRYPTO.h"
+#include "boot_trace.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -46,8 +47,10 @@ check_public_key(void *pCrypto_Handler, uint8_t *pub_key, uint32_t *buff, int si
     return res;
 }
 
+// check the public key and hash the header with the zeroed sign area, *offset
+// returns where the image data hashing has to continue from
 int32_t
-CRYPTO_Verify_Flash_Signature(void *pCrypto_Handler, const void *flash_zone, int sign_mode)
+CRYPTO_Sign_Hash_Begin(void *pCrypto_Handler, const void *flash_zone, int sign_mode, uint32_t *offset)
 {
     int32_t res = CSK_DRIVER_OK;
     const ls_ota_header_t *hdr = (const ls_ota_header_t*)flash_zone;
@@ -91,48 +94,83 @@ CRYPTO_Verify_Flash_Signature(void *pCrypto_Handler, const void *flash_zone, int
             len += CRYPTO_SIGN_BUFF_SIZE;
         }
 
-        /// calculate the image data
-        len += sizeof(ls_ota_header_t);
-        while(len < hdr->size && res == CSK_DRIVER_OK)
-        {
-            size = hdr->size - len;
-            if(size > CRYPTO_MAX_PACKAGE_SIZE)
-            {
-                size = CRYPTO_MAX_PACKAGE_SIZE;
-                res = CRYPTO_Hash(pCrypto_Handler, (uint32_t*)(((uint8_t*)hdr)+len), size, NULL, 1);
-            }
-            else
-            {
-                res = CRYPTO_Hash(pCrypto_Handler, (uint32_t*)(((uint8_t*)hdr)+len), size, buff, 1);
-            }
+        *offset = len + sizeof(ls_ota_header_t);
+    }while(0);
+
+    return res;
+}
+
+// check the sha256 digest of the whole zone against its signature
+int32_t
+CRYPTO_Sign_Verify_Digest(void *pCrypto_Handler, const void *flash_zone, int sign_mode, uint32_t *digest)
+{
+    int32_t res = CSK_DRIVER_OK;
+    const ls_ota_header_t *hdr = (const ls_ota_header_t*)flash_zone;
+
+    if(sign_mode==OTA_SIGN_SHA256)
+    {
+        if(memcmp(digest, hdr->sign, sign_size[sign_mode])!=0)
+            res = CSK_CRYPTO_ERROR_VERIFY;
+    }
+    else if(sign_mode==OTA_SIGN_ECSDA256)
+    {
+        CRYPTO_Control(pCrypto_Handler, CSK_CRYPTO_SET_ECC_CURVE, (uint32_t)&CRYPTO_ECC_CURVE_P256);
+
+        res = CRYPTO_ECSDA_Verify_Signature(pCrypto_Handler, digest, (uint32_t*)(hdr->sign+sign_size[sign_mode]/8), (uint32_t*)hdr->sign);
+    }
+    else if(sign_mode==OTA_SIGN_RSA2048)
+    {
+        uint32_t crypto_rsa_e_bigendian = 0x01000100;
+        CRYPTO_Control(pCrypto_Handler,CSK_CRYPTO_SET_RSA_RSA2048, 0);
+        CRYPTO_Control(pCrypto_Handler,CSK_CRYPTO_SET_RSA_PADDING_MODE, CSK_CRYPTO_RSA_PADDING_PSS);
+
+        res = CRYPTO_RSA_Verify_Signature(pCrypto_Handler, digest, 32,
+                hdr->sign+sign_size[sign_mode]/8, crypto_rsa_e_bigendian, hdr->sign);
+    }
+
+    return res;
+}
 
-            len += size;
-        };
+int32_t
+CRYPTO_Verify_Flash_Signature(void *pCrypto_Handler, const void *flash_zone, int sign_mode)
+{
+    int32_t res = CSK_DRIVER_OK;
+    const ls_ota_header_t *hdr = (const ls_ota_header_t*)flash_zone;
+    uint32_t buff[CRYPTO_SIGN_BUFF_SIZE];
+    uint32_t len, size;
+
+    boot_trace(BOOT_TRACE_SIGN_BEGIN, sign_mode);
+    memset(buff, 0, sizeof(buff));
+    res = CRYPTO_Sign_Hash_Begin(pCrypto_Handler, flash_zone, sign_mode, &len);
+    if(res != CSK_DRIVER_OK)
+    {
+        boot_trace(BOOT_TRACE_SIGN_DONE, res);
+        return res;
+    }
 
-        if(sign_mode==OTA_SIGN_SHA256)
+    /// calculate the image data
+    while(len < hdr->size && res == CSK_DRIVER_OK)
+    {
+        size = hdr->size - len;
+        if(size > CRYPTO_MAX_PACKAGE_SIZE)
         {
-            if(memcmp(buff, hdr->sign, sign_size[sign_mode])!=0)
-                res = CSK_CRYPTO_ERROR_VERIFY;
-            break;
+            size = CRYPTO_MAX_PACKAGE_SIZE;
+            res = CRYPTO_Hash(pCrypto_Handler, (uint32_t*)(((uint8_t*)hdr)+len), size, NULL, 1);
         }
-        else if(sign_mode==OTA_SIGN_ECSDA256)
+        else
         {
-            CRYPTO_Control(pCrypto_Handler, CSK_CRYPTO_SET_ECC_CURVE, (uint32_t)&CRYPTO_ECC_CURVE_P256);
-
-            res = CRYPTO_ECSDA_Verify_Signature(pCrypto_Handler, buff, (uint32_t*)(hdr->sign+sign_size[sign_mode]/8), (uint32_t*)hdr->sign);
-            break;
+            res = CRYPTO_Hash(pCrypto_Handler, (uint32_t*)(((uint8_t*)hdr)+len), size, buff, 1);
         }
-        else if(sign_mode==OTA_SIGN_RSA2048)
-        {
-            uint32_t crypto_rsa_e_bigendian = 0x01000100;
-            CRYPTO_Control(pCrypto_Handler,CSK_CRYPTO_SET_RSA_RSA2048, 0);
-            CRYPTO_Control(pCrypto_Handler,CSK_CRYPTO_SET_RSA_PADDING_MODE, CSK_CRYPTO_RSA_PADDING_PSS);
 
-            res = CRYPTO_RSA_Verify_Signature(pCrypto_Handler, buff, 32,
-                    hdr->sign+sign_size[sign_mode]/8, crypto_rsa_e_bigendian, hdr->sign);
-            break;
-        }
-    }while(0);
+        len += size;
+    };
+    boot_trace(BOOT_TRACE_SIGN_HASHED, len);
+
+    if(res == CSK_DRIVER_OK)
+    {
+        res = CRYPTO_Sign_Verify_Digest(pCrypto_Handler, flash_zone, sign_mode, buff);
+    }
+    boot_trace(BOOT_TRACE_SIGN_DONE, res);
 
     return res;
 }
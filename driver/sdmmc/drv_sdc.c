@@ -480,6 +480,92 @@ lib_sdc_read_sector(u8 ip_idx, u32 sector, u32 cnt, void* buff)
     sd_mutex_unlock(ip_idx);
     return ret;
 }
+#define SDC_HS_CLOCK        50000000
+
+/*
+ * Step the bus up to width (1 or 4) and speed (0 default, 1 high speed) where
+ * the card supports them. Each step is checked by reading block 0 into buf and
+ * is undone if that fails, e.g. on data CRC errors from a poorly routed board.
+ * Returns the reached mode: bus width in bits 0~7, bus speed in bits 8~15.
+ */
+u32
+lib_sdc_negotiate_bus(u8 ip_idx, u8 width, u8 speed, void* buf)
+{
+    u32 mode;
+
+    sd_mutex_lock(ip_idx);
+    if (lib_sdc_card_exist(ip_idx) != ERR_SD_NO_ERROR) {
+        sd_mutex_unlock(ip_idx);
+        return 0;
+    }
+
+    if ((width == 4) && (SDHost[ip_idx].Card->bus_width != 4)) {
+        if (ftsdc021_set_bus_width(ip_idx, 4) || (lib_sdc_read(ip_idx, 0, 1, buf) != ERR_SD_NO_ERROR)) {
+            sdc_dbg_print(" WARN## ... 4 bit bus failed, back to 1 bit.\n");
+            ftsdc021_set_bus_width(ip_idx, 1);
+        }
+    }
+
+    if ((speed == 1) && (SDHost[ip_idx].Card->speed == 0)) {
+        /* the driver keeps 25 MHz after the switch, raise it to the HS rate here */
+        if (ftsdc021_set_bus_speed_mode(ip_idx, 1) == 0) {
+            SDHost[ip_idx].Card->max_dtr = SDC_HS_CLOCK;
+            ftsdc021_SetSDClock(ip_idx, SDHost[ip_idx].Card->max_dtr);
+            if (lib_sdc_read(ip_idx, 0, 1, buf) != ERR_SD_NO_ERROR)
+                speed = 0;
+        } else
+            speed = 0;
+
+        if (speed == 0) {
+            sdc_dbg_print(" WARN## ... High speed failed, back to default speed.\n");
+            ftsdc021_set_bus_speed_mode(ip_idx, 0);
+        }
+    }
+
+    mode = SDHost[ip_idx].Card->bus_width | ((u32) SDHost[ip_idx].Card->speed << 8);
+    sd_mutex_unlock(ip_idx);
+    return mode;
+}
+
+/*
+ * Multi-block read (CMD18 + auto CMD12) through ADMA2 straight into buff.
+ * The caller owns the descriptor table set by GM_SDC_ACTION_SET_ADMA_BUFER;
+ * without one the transfer stays on SDMA. The previous transfer type is restored.
+ */
+SD_RESULT
+lib_sdc_read_sector_adma(u8 ip_idx, u32 sector, u32 cnt, void* buff)
+{
+    SD_RESULT ret;
+    Transfer_Type type;
+    u32 line_bound;
+    u8 auto_cmd;
+
+    sd_mutex_lock(ip_idx);
+    ret = lib_sdc_card_exist(ip_idx);
+    if (ret != ERR_SD_NO_ERROR) {
+        sd_mutex_unlock(ip_idx);
+        return ret;
+    }
+
+    type = SDHost[ip_idx].Card->FlowSet.UseDMA;
+    line_bound = SDHost[ip_idx].Card->FlowSet.lineBound;
+    auto_cmd = SDHost[ip_idx].Card->FlowSet.autoCmd;
+
+    if (SDHost[ip_idx].Card->FlowSet.adma_buffer)
+        ftsdc021_set_transfer_type(ip_idx, ADMA, 0);
+    SDHost[ip_idx].Card->FlowSet.autoCmd = 1;
+
+    sdc_dbg_print("r: sector=%d cnt=%d adma\n", sector, cnt);
+    ret = lib_sdc_read(ip_idx, sector, cnt, buff);
+
+    SDHost[ip_idx].Card->FlowSet.autoCmd = auto_cmd;
+    if (type != SDHost[ip_idx].Card->FlowSet.UseDMA)
+        ftsdc021_set_transfer_type(ip_idx, type, line_bound);
+
+    sd_mutex_unlock(ip_idx);
+    return ret;
+}
+
 SD_RESULT
 lib_sdc_write_sector(u8 ip_idx, u32 sector, u32 cnt, void* buff)
 {
@@ -871,6 +957,20 @@ gm_sdc_api_sdcard_sector_read(u8 ip_idx, u32 sector, u32 cnt, void* buff)
     return (u32) ret;
 }
 
+u32
+gm_sdc_api_negotiate_bus(u8 ip_idx, u8 width, u8 speed, void* buf)
+{
+    return lib_sdc_negotiate_bus(ip_idx, width, speed, buf);
+}
+
+u32
+gm_sdc_api_sdcard_bulk_read(u8 ip_idx, u32 sector, u32 cnt, void* buff)
+{
+    SD_RESULT ret;
+    ret = lib_sdc_read_sector_adma(ip_idx, sector, cnt, buff);
+    return (u32) ret;
+}
+
 u32
 gm_sdc_api_sdcard_sector_write(u8 ip_idx, u32 sector, u32 cnt, void* buff)
 {
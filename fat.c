@@ -0,0 +1,286 @@
+/*
+ * fat.c
+ *
+ *  Minimal read-only FAT16/FAT32 reader for SD boot.
+ *
+ *  The window caches whichever sector was read last. FAT sectors and data or
+ *  directory sectors never share a sector number, so a FAT lookup after a
+ *  directory scan or a partial data read simply reloads the window.
+ */
+
+#include <string.h>
+#include "fat.h"
+
+#define FAT_WIN_NONE        0xFFFFFFFFUL
+#define FAT_DIR_ENTRY       32
+#define FAT_ATTR_VOLUME     0x08    /* also set in long file name entries */
+#define FAT_ATTR_DIR        0x10
+#define FAT_DIR_DELETED     0xE5
+
+#define LD16(p)     ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8))
+#define LD32(p)     (LD16(p) | (LD16((p) + 2) << 16))
+
+static fat_status_t
+fat_win_load(fat_t *fs, uint32_t sect)
+{
+    if (fs->win_sect == sect) {
+        return FAT_OK;
+    }
+
+    fs->win_sect = FAT_WIN_NONE;
+    if (fs->read(sect, 1, fs->win)) {
+        return FAT_ERR_IO;
+    }
+    fs->win_sect = sect;
+
+    return FAT_OK;
+}
+
+/* next cluster of the chain, 0 at the end of the chain or a fat_status_t on errors */
+static int32_t
+fat_next(fat_t *fs, uint32_t clus)
+{
+    uint32_t off, val;
+
+    off = fs->fat32 ? clus * 4 : clus * 2;
+    if (fat_win_load(fs, fs->fat_lba + off / FAT_SECTOR_SIZE)) {
+        return FAT_ERR_IO;
+    }
+    off %= FAT_SECTOR_SIZE;
+
+    if (fs->fat32) {
+        val = LD32(fs->win + off) & 0x0FFFFFFF;
+        if (val >= 0x0FFFFFF8) {
+            return 0;
+        }
+    } else {
+        val = LD16(fs->win + off);
+        if (val >= 0xFFF8) {
+            return 0;
+        }
+    }
+
+    if (val < 2 || val >= fs->max_clus) {
+        return FAT_ERR_CHAIN;
+    }
+    return (int32_t)val;
+}
+
+static uint32_t
+fat_clus_lba(fat_t *fs, uint32_t clus)
+{
+    return fs->data_lba + ((clus - 2) << fs->clus_shift);
+}
+
+fat_status_t
+fat_mount(fat_t *fs, uint32_t lba, uint8_t *win, fat_read_fn read)
+{
+    uint8_t *b = win;
+    uint32_t spc, rsvd, nfats, root_ent, total, fat_size, nclus;
+
+    memset(fs, 0, sizeof(fat_t));
+    fs->read = read;
+    fs->win = win;
+    fs->win_sect = FAT_WIN_NONE;
+
+    if (fat_win_load(fs, lba)) {
+        return FAT_ERR_IO;
+    }
+
+    if (LD16(b + 510) != 0xAA55 || LD16(b + 11) != FAT_SECTOR_SIZE) {
+        return FAT_ERR_NO_FS;
+    }
+
+    spc = b[13];
+    rsvd = LD16(b + 14);
+    nfats = b[16];
+    root_ent = LD16(b + 17);
+    total = LD16(b + 19);
+    if (total == 0) {
+        total = LD32(b + 32);
+    }
+    fat_size = LD16(b + 22);
+    if (fat_size == 0) {
+        fat_size = LD32(b + 36);
+    }
+
+    if (spc == 0 || (spc & (spc - 1)) || rsvd == 0 || nfats == 0 || fat_size == 0) {
+        return FAT_ERR_NO_FS;
+    }
+    while ((1U << fs->clus_shift) < spc) {
+        fs->clus_shift++;
+    }
+
+    fs->fat_lba = lba + rsvd;
+    fs->root_lba = fs->fat_lba + nfats * fat_size;
+    fs->root_secs = (root_ent * FAT_DIR_ENTRY + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
+    fs->data_lba = fs->root_lba + fs->root_secs;
+
+    if (total <= fs->data_lba - lba) {
+        return FAT_ERR_NO_FS;
+    }
+    nclus = (total - (fs->data_lba - lba)) >> fs->clus_shift;
+
+    /* the cluster count alone decides the FAT type, FAT12 is not supported */
+    if (nclus < 4085) {
+        return FAT_ERR_NO_FS;
+    }
+    fs->fat32 = (nclus >= 65525);
+    fs->max_clus = nclus + 2;
+
+    if (fs->fat32) {
+        fs->root_clus = LD32(b + 44);
+        if (root_ent != 0 || fs->root_clus < 2 || fs->root_clus >= fs->max_clus) {
+            return FAT_ERR_NO_FS;
+        }
+    } else if (root_ent == 0) {
+        return FAT_ERR_NO_FS;
+    }
+
+    return FAT_OK;
+}
+
+fat_status_t
+fat_open(fat_t *fs, fat_file_t *f, const char *path)
+{
+    uint8_t name[11], *e;
+    uint32_t i, idx, sect, clus;
+    int32_t next;
+
+    /* "/boot.bin" -> "BOOT    BIN" */
+    while (*path == '/') {
+        path++;
+    }
+    memset(name, ' ', sizeof(name));
+    for (i = 0; *path && *path != '.'; path++) {
+        if (i >= 8) {
+            return FAT_ERR_NOT_FOUND;
+        }
+        name[i++] = (*path >= 'a' && *path <= 'z') ? *path - 'a' + 'A' : *path;
+    }
+    if (*path == '.') {
+        for (path++, i = 8; *path; path++) {
+            if (i >= 11) {
+                return FAT_ERR_NOT_FOUND;
+            }
+            name[i++] = (*path >= 'a' && *path <= 'z') ? *path - 'a' + 'A' : *path;
+        }
+    }
+
+    clus = fs->root_clus;
+    for (idx = 0; ; idx++) {
+        if (fs->fat32) {
+            if (idx == (1U << fs->clus_shift)) {
+                next = fat_next(fs, clus);
+                if (next <= 0) {
+                    return next ? (fat_status_t)next : FAT_ERR_NOT_FOUND;
+                }
+                clus = next;
+                idx = 0;
+            }
+            sect = fat_clus_lba(fs, clus) + idx;
+        } else {
+            if (idx == fs->root_secs) {
+                return FAT_ERR_NOT_FOUND;
+            }
+            sect = fs->root_lba + idx;
+        }
+
+        if (fat_win_load(fs, sect)) {
+            return FAT_ERR_IO;
+        }
+
+        for (e = fs->win; e < fs->win + FAT_SECTOR_SIZE; e += FAT_DIR_ENTRY) {
+            if (e[0] == 0) {
+                return FAT_ERR_NOT_FOUND;
+            }
+            if (e[0] == FAT_DIR_DELETED || (e[11] & (FAT_ATTR_VOLUME | FAT_ATTR_DIR))) {
+                continue;
+            }
+            if (memcmp(e, name, sizeof(name))) {
+                continue;
+            }
+
+            f->fs = fs;
+            f->size = LD32(e + 28);
+            f->pos = 0;
+            f->clus = LD16(e + 26);
+            if (fs->fat32) {
+                f->clus |= LD16(e + 20) << 16;
+            }
+            if (f->size && (f->clus < 2 || f->clus >= fs->max_clus)) {
+                return FAT_ERR_CHAIN;
+            }
+            return FAT_OK;
+        }
+    }
+}
+
+int32_t
+fat_read(fat_file_t *f, uint8_t *dst, uint32_t len)
+{
+    fat_t *fs = f->fs;
+    uint32_t clus_bytes = FAT_SECTOR_SIZE << fs->clus_shift;
+    uint32_t done = 0, off, run, last, sect, n;
+    int32_t next;
+
+    if (len > f->size - f->pos) {
+        len = f->size - f->pos;
+    }
+
+    /* f->clus holds the byte at pos, or the byte before it when pos ends a cluster */
+    while (done < len) {
+        off = f->pos & (clus_bytes - 1);
+        if (off == 0 && f->pos) {
+            next = fat_next(fs, f->clus);
+            if (next <= 0) {
+                return next ? next : FAT_ERR_CHAIN;
+            }
+            f->clus = next;
+        }
+
+        /* merge the following clusters while they are contiguous */
+        run = clus_bytes - off;
+        last = f->clus;
+        while (run < len - done) {
+            next = fat_next(fs, last);
+            if (next < 0) {
+                return next;
+            }
+            if ((uint32_t)next != last + 1) {
+                break;
+            }
+            last = next;
+            run += clus_bytes;
+        }
+        if (run > len - done) {
+            run = len - done;
+        }
+
+        sect = fat_clus_lba(fs, f->clus) + off / FAT_SECTOR_SIZE;
+        off %= FAT_SECTOR_SIZE;
+        if (off || run < FAT_SECTOR_SIZE) {
+            /* partial sector through the window */
+            if (fat_win_load(fs, sect)) {
+                return FAT_ERR_IO;
+            }
+            n = FAT_SECTOR_SIZE - off;
+            if (n > run) {
+                n = run;
+            }
+            memcpy(dst, fs->win + off, n);
+        } else {
+            n = run & ~(FAT_SECTOR_SIZE - 1);
+            if (fs->read(sect, n / FAT_SECTOR_SIZE, dst)) {
+                return FAT_ERR_IO;
+            }
+        }
+
+        f->clus += ((f->pos & (clus_bytes - 1)) + n - 1) / clus_bytes;
+        f->pos += n;
+        dst += n;
+        done += n;
+    }
+
+    return (int32_t)done;
+}
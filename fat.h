@@ -0,0 +1,68 @@
+/*
+ * fat.h
+ *
+ *  Minimal read-only FAT16/FAT32 reader for SD boot.
+ *
+ *  Only 8.3 names in the root directory are looked up. Sectors come from a
+ *  caller supplied block reader, and the only buffer is one 512-byte window
+ *  that caches a single FAT sector (directory scans and unaligned file data
+ *  borrow it as well). File data is read cluster run by cluster run, so a
+ *  contiguous file costs about as much as reading the raw sectors.
+ */
+
+#ifndef _FAT_H_
+#define _FAT_H_
+
+#include <stdint.h>
+
+#define FAT_SECTOR_SIZE     512
+
+typedef enum
+{
+    FAT_OK = 0,
+    FAT_ERR_IO = -1,
+    FAT_ERR_NO_FS = -2,
+    FAT_ERR_NOT_FOUND = -3,
+    FAT_ERR_CHAIN = -4,
+} fat_status_t;
+
+/* read cnt sectors starting at sector into buf, returns 0 on success */
+typedef int (*fat_read_fn)(uint32_t sector, uint32_t cnt, uint8_t *buf);
+
+typedef struct
+{
+    fat_read_fn read;
+    uint8_t *win;           /* FAT_SECTOR_SIZE bytes, DMA capable */
+    uint32_t win_sect;      /* sector held in win, 0xFFFFFFFF if none */
+
+    uint8_t fat32;
+    uint8_t clus_shift;     /* log2(sectors per cluster) */
+    uint32_t fat_lba;
+    uint32_t root_lba;      /* FAT16 fixed root directory */
+    uint32_t root_secs;
+    uint32_t root_clus;     /* FAT32 root directory cluster */
+    uint32_t data_lba;
+    uint32_t max_clus;      /* number of clusters + 2 */
+} fat_t;
+
+typedef struct
+{
+    fat_t *fs;
+    uint32_t size;
+    uint32_t pos;
+    uint32_t clus;          /* cluster holding pos */
+} fat_file_t;
+
+/* mount the volume whose boot sector is at lba, win is kept for the fat_t lifetime */
+fat_status_t
+fat_mount(fat_t *fs, uint32_t lba, uint8_t *win, fat_read_fn read);
+
+/* open an 8.3 file in the root directory, e.g. "/BOOT.BIN" */
+fat_status_t
+fat_open(fat_t *fs, fat_file_t *f, const char *path);
+
+/* read up to len bytes at the current position, returns the bytes read or a fat_status_t */
+int32_t
+fat_read(fat_file_t *f, uint8_t *dst, uint32_t len);
+
+#endif /* _FAT_H_ */
@@ -16,6 +16,8 @@
 #include "spiflash.h"
 #include "list.h"
 #include "queue.h"
+#include "systick.h"
+#include "cache.h"
 
 PROCESS_NAME(uart_boot_process);
 /*---------------------------------------------------------------------------*/
@@ -32,8 +34,14 @@ extern FLASH_DEV flash_dev;
 
 static int flash_chip_erase = 0; // 1: chip erase, 0: sector erase
 
+// flash_block_diff() results
+#define FLASH_DIFF_SAME     0   // nothing to do
+#define FLASH_DIFF_PROG     1   // only 1->0 bit flips, program without erase
+#define FLASH_DIFF_ERASE    2   // erase and program
+
 void flash_prog_init()
 {
+    flash_prog.erase_ahead = FLASH_ERASE_AHEAD_DEF;
     process_start(&flash_prog_process, NULL);
     process_start(&erase_a_block_process, NULL);
     process_start(&program_process, NULL);
@@ -46,7 +54,7 @@ PROCESS_THREAD(erase_a_block_process, ev, data)
     int ret;
     unsigned int result, timeout = flash_dev.timeout;
     static unsigned long FlashAddr;
-    uint32_t remain_size = 0;
+    uint32_t remain_size = 0, erase_size;
 
     PROCESS_BEGIN();
     while(1) {
@@ -115,16 +123,19 @@ PROCESS_THREAD(erase_a_block_process, ev, data)
             }           
             flash_prog.erase_size += remain_size;
         } else {
-            if(!(FlashAddr & SPIROM_BLK64_MASK) && remain_size >= SPIROM_BLK64_SIZE) {
+            // incremental mode erases sector by sector, the neighbours may be skipped
+            if(!flash_prog.incremental && !(FlashAddr & SPIROM_BLK64_MASK) && remain_size >= SPIROM_BLK64_SIZE) {
                 result = spirom_cmd_send(&flash_dev, SPIROM_CMD_ERASE_B64, FlashAddr, 0, NULL, &RetData);
-                flash_prog.erase_size += SPIROM_BLK64_SIZE;
-            } else if(!(FlashAddr & SPIROM_BLK32_MASK) && remain_size >= SPIROM_BLK32_SIZE) {
+                erase_size = SPIROM_BLK64_SIZE;
+            } else if(!flash_prog.incremental && !(FlashAddr & SPIROM_BLK32_MASK) && remain_size >= SPIROM_BLK32_SIZE) {
                 result = spirom_cmd_send(&flash_dev, SPIROM_CMD_ERASE_B32, FlashAddr, 0, NULL, &RetData);
-                flash_prog.erase_size += SPIROM_BLK32_SIZE;
+                erase_size = SPIROM_BLK32_SIZE;
             } else {
                 result = spirom_cmd_send(&flash_dev, SPIROM_CMD_ERASE, FlashAddr, 0, NULL, &RetData);
-                flash_prog.erase_size += SPIROM_SECTOR_SIZE;
+                erase_size = SPIROM_SECTOR_SIZE;
             }
+            flash_prog.erase_size += erase_size;
+            flash_prog.erase_sect += erase_size / SPIROM_SECTOR_SIZE;
         }
         
 		if(result != 0) {
@@ -256,7 +267,8 @@ int32_t erase_sectors(void *addr)
 {
 	uint32_t flash_addr = *((uint32_t *)addr);
 
-	if(flash_prog.flash_offset + flash_prog.erase_size > flash_addr) {  // erased already
+	// erase_size is no erase front in incremental mode, each sector is erased on demand
+	if(!flash_prog.incremental && flash_prog.flash_offset + flash_prog.erase_size > flash_addr) {  // erased already
 		return 0;
 	} else {
 		BOOT_LOG("era-%d-%d->\n", flash_addr, flash_prog.erase_size);
@@ -265,12 +277,57 @@ int32_t erase_sectors(void *addr)
 	}
 }
 
+// erase ahead while no data is waiting, as long as the erase front stays
+// within erase_ahead bytes of the program front and inside the download
+static int32_t erase_ahead_due()
+{
+	uint32_t prog_front = LOAD_BLK_SIZE * flash_prog.cnt;
+
+	return (flash_prog.erasing == 0 && flash_prog.erase_ahead && !flash_prog.incremental
+			&& flash_prog.erase_size < flash_prog.total_size
+			&& flash_prog.erase_size - prog_front < flash_prog.erase_ahead);
+}
+
+// compare a block with what the flash holds already
+static int flash_block_diff(uint32_t flash_addr, const uint8_t *data, uint32_t size)
+{
+	const uint8_t *old = (const uint8_t *)(AP_FLASH_BASE + flash_addr);
+	int diff = FLASH_DIFF_SAME;
+	uint32_t i, o, n;
+
+	// the flash window may still cache what was there before an earlier erase/program
+	HAL_InvalidateDCache_by_Addr((uint32_t *)old, size);
+
+	// data is 4 bytes aligned, so is the sector
+	for(i = 0; i + 4 <= size; i += 4) {
+		o = *(const uint32_t *)(old + i);
+		n = *(const uint32_t *)(data + i);
+		if(o != n) {
+			if(n & ~o) {  // a 0->1 flip needs an erase
+				return FLASH_DIFF_ERASE;
+			}
+			diff = FLASH_DIFF_PROG;
+		}
+	}
+	for(; i < size; i++) {
+		if(old[i] != data[i]) {
+			if(data[i] & ~old[i]) {
+				return FLASH_DIFF_ERASE;
+			}
+			diff = FLASH_DIFF_PROG;
+		}
+	}
+
+	return diff;
+}
+
 flash_ops_data flash_ops;
 
 PROCESS_THREAD(flash_prog_process, ev, data)
 {
-	static int idx;
+	static int idx, diff;
 	static char event;
+	static uint32_t erase_addr, tick;
 
 	PROCESS_BEGIN();
 
@@ -317,22 +374,54 @@ PROCESS_THREAD(flash_prog_process, ev, data)
 
 		while(1) {
 			idx = flash_get_rdy_buf();
-			if(idx < 0)
-				break;
+			if(idx < 0) {
+				if(!erase_ahead_due())
+					break;
+				// the flash is idle until the next block arrives, erase for it now
+				erase_addr = flash_prog.flash_offset + flash_prog.erase_size;
+				flash_chip_erase = 0;
+				flash_prog.erasing = 1;
+				erase_sectors(&erase_addr);
+				while(1) {
+					PROCESS_WAIT_EVENT();
+					if(ev == PROCESS_EVENT_CONTINUE) {
+						break;
+					}
+				}
+				// on error leave the rest to the data path, which reports it
+				flash_prog.erasing = (int)data ? 2 : 0;
+				// flash_prog_in_process() changed, wake up a waiting FLASH_END
+				process_post(&uart_boot_process,  PROCESS_EVENT_BUF_FREE, NULL);
+				continue;
+			}
 			flash_ops.data = flash_prog.data_ctrl[idx].buf_idx * LOAD_BLK_SIZE + flash_prog.load_base;
 			flash_ops.flash_addr = flash_prog.flash_offset + LOAD_BLK_SIZE * flash_prog.cnt;
 			flash_ops.size = flash_prog.data_ctrl[idx].size;
 			flash_ops.ctrl_idx = idx;
 
+			diff = FLASH_DIFF_ERASE;
+			if(flash_prog.incremental) {
+				diff = flash_block_diff(flash_ops.flash_addr, flash_ops.data, flash_ops.size);
+				if(diff == FLASH_DIFF_SAME) {
+					BOOT_LOG("skip-%d->\n", flash_ops.flash_addr);
+					flash_prog.skip_sect++;
+					event = PROCESS_EVENT_BUF_FREE;
+					flash_prog.cnt++;
+					goto END;
+				}
+			}
+
 			//erase a sector
             flash_chip_erase = 0;
-			if(erase_sectors(&flash_ops.flash_addr)) {
+			if(diff == FLASH_DIFF_ERASE && erase_sectors(&flash_ops.flash_addr)) {
+				tick = SysTick_Value();
 				while(1) {
 					PROCESS_WAIT_EVENT();
 					if(ev != PROCESS_EVENT_BUF_RDY) {
 						break;
 					}
 				}
+				flash_prog.erase_stall += SysTick_Value() - tick;
 				if((int)data) {
 					event = PROCESS_EVENT_PROG_ERR;
 					goto END;
@@ -354,6 +443,7 @@ PROCESS_THREAD(flash_prog_process, ev, data)
 			event = PROCESS_EVENT_BUF_FREE;
 			// update information of flash_prog
 			flash_prog.cnt++;
+			flash_prog.prog_sect++;
 
 			END:
 			flash_set_buf_free();
@@ -0,0 +1,129 @@
+/*
+ * gpt.c
+ *
+ *  GUID partition table lookup, see gpt.h. Only the primary table is used,
+ *  a card whose primary header or entry array fails its CRC is treated as
+ *  having no GPT and the caller falls back to the MBR.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "gpt.h"
+
+extern uint32_t crc32(uint32_t val, const uint8_t *buf, size_t len);
+
+#define GPT_SIGNATURE       "EFI PART"
+#define GPT_HDR_SIZE_MIN    92
+#define GPT_ENTRY_SIZE_MIN  128
+
+#define LD16(p)     ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8))
+#define LD32(p)     (LD16(p) | (LD16((p) + 2) << 16))
+
+/* GUID in its on-disk byte order, the first three fields are little endian */
+#define GPT_GUID(d1, d2, d3, d4, d5) { \
+    (d1) & 0xFF, ((d1) >> 8) & 0xFF, ((d1) >> 16) & 0xFF, ((d1) >> 24) & 0xFF, \
+    (d2) & 0xFF, ((d2) >> 8) & 0xFF, (d3) & 0xFF, ((d3) >> 8) & 0xFF, \
+    ((d4) >> 8) & 0xFF, (d4) & 0xFF, \
+    ((d5) >> 40) & 0xFF, ((d5) >> 32) & 0xFF, ((d5) >> 24) & 0xFF, \
+    ((d5) >> 16) & 0xFF, ((d5) >> 8) & 0xFF, (d5) & 0xFF }
+
+/* the boot types are vendor specific and must match the imaging tool */
+static const uint8_t gpt_type_guid[GPT_PART_COUNT][16] = {
+    [GPT_PART_BOOT]   = GPT_GUID(0xB007C0DEUL, 0x5D1F, 0x4E0A, 0x8C55, 0x6E1A3F0B0000ULL),
+    [GPT_PART_BOOT_A] = GPT_GUID(0xB007C0DEUL, 0x5D1F, 0x4E0A, 0x8C55, 0x6E1A3F0B000AULL),
+    [GPT_PART_BOOT_B] = GPT_GUID(0xB007C0DEUL, 0x5D1F, 0x4E0A, 0x8C55, 0x6E1A3F0B000BULL),
+    /* Microsoft basic data, what most imaging tools use for a FAT data partition */
+    [GPT_PART_DATA]   = GPT_GUID(0xEBD0A0A2UL, 0xB9E5, 0x4433, 0x87C0, 0x68B6B72699C7ULL),
+};
+
+static void
+gpt_match(gpt_t *gpt, const uint8_t *e)
+{
+    uint32_t id;
+
+    for (id = 0; id < GPT_PART_COUNT; id++) {
+        if (gpt->part[id].last_lba || memcmp(e, gpt_type_guid[id], 16)) {
+            continue;
+        }
+        /* LBAs beyond 32 bits can't be addressed by the sector API */
+        if (LD32(e + 36) || LD32(e + 44) || LD32(e + 40) < LD32(e + 32)) {
+            continue;
+        }
+        gpt->part[id].first_lba = LD32(e + 32);
+        gpt->part[id].last_lba = LD32(e + 40);
+        return;
+    }
+}
+
+gpt_status_t
+gpt_scan(gpt_t *gpt, uint8_t *buf, uint32_t buf_secs, gpt_read_fn read)
+{
+    uint32_t hdr_size, hdr_crc, lba, num, size, array_crc, crc;
+    uint32_t left, secs, bytes, off;
+
+    memset(gpt, 0, sizeof(gpt_t));
+
+    if (read(GPT_HEADER_LBA, 1, buf)) {
+        return GPT_ERR_IO;
+    }
+
+    hdr_size = LD32(buf + 12);
+    if (memcmp(buf, GPT_SIGNATURE, 8) || hdr_size < GPT_HDR_SIZE_MIN || hdr_size > GPT_SECTOR_SIZE ||
+            LD32(buf + 24) != GPT_HEADER_LBA || LD32(buf + 28)) {
+        return GPT_ERR_NO_GPT;
+    }
+
+    /* the header CRC is computed with its own field zeroed */
+    hdr_crc = LD32(buf + 16);
+    memset(buf + 16, 0, 4);
+    if (crc32(0, buf, hdr_size) != hdr_crc) {
+        return GPT_ERR_CRC;
+    }
+
+    lba = LD32(buf + 72);
+    num = LD32(buf + 80);
+    size = LD32(buf + 84);
+    array_crc = LD32(buf + 88);
+
+    /* 128 * 2^n byte entries, none of them straddles a sector */
+    if (LD32(buf + 76) || lba < 2 || size < GPT_ENTRY_SIZE_MIN || size > GPT_SECTOR_SIZE || (size & (size - 1)) ||
+            num == 0 || num > GPT_MAX_ARRAY_SECS * (GPT_SECTOR_SIZE / size)) {
+        return GPT_ERR_NO_GPT;
+    }
+
+    left = num * size;
+    crc = 0;
+    while (left) {
+        bytes = (left > buf_secs * GPT_SECTOR_SIZE) ? buf_secs * GPT_SECTOR_SIZE : left;
+        secs = (bytes + GPT_SECTOR_SIZE - 1) / GPT_SECTOR_SIZE;
+        if (read(lba, secs, buf)) {
+            memset(gpt, 0, sizeof(gpt_t));
+            return GPT_ERR_IO;
+        }
+
+        crc = crc32(crc, buf, bytes);
+        for (off = 0; off < bytes; off += size) {
+            gpt_match(gpt, buf + off);
+        }
+
+        lba += secs;
+        left -= bytes;
+    }
+
+    if (crc != array_crc) {
+        memset(gpt, 0, sizeof(gpt_t));
+        return GPT_ERR_CRC;
+    }
+
+    gpt->valid = 1;
+    return GPT_OK;
+}
+
+const gpt_part_t *
+gpt_find(const gpt_t *gpt, gpt_part_id_t id)
+{
+    if (!gpt->valid || id >= GPT_PART_COUNT || gpt->part[id].last_lba == 0) {
+        return NULL;
+    }
+    return &gpt->part[id];
+}
@@ -0,0 +1,65 @@
+/*
+ * gpt.h
+ *
+ *  GUID partition table lookup for SD boot and ESP_SD_* programming.
+ *
+ *  The primary header is checked against its CRC32, then the whole entry
+ *  array is read in multi-sector batches and checked against the array CRC32
+ *  while the known partition types are picked out. Later lookups only touch
+ *  the gpt_t, so finding a partition never costs another sector read.
+ */
+
+#ifndef _GPT_H_
+#define _GPT_H_
+
+#include <stdint.h>
+
+#define GPT_SECTOR_SIZE     512
+#define GPT_HEADER_LBA      1
+/* entry arrays beyond this are refused, which bounds a scan to a few batch reads */
+#define GPT_MAX_ARRAY_SECS  256
+
+/* protective MBR partition type */
+#define GPT_MBR_TYPE        0xEE
+
+typedef enum
+{
+    GPT_PART_BOOT = 0,
+    GPT_PART_BOOT_A,
+    GPT_PART_BOOT_B,
+    GPT_PART_DATA,
+    GPT_PART_COUNT
+} gpt_part_id_t;
+
+typedef enum
+{
+    GPT_OK = 0,
+    GPT_ERR_IO = -1,
+    GPT_ERR_NO_GPT = -2,
+    GPT_ERR_CRC = -3,
+} gpt_status_t;
+
+/* read cnt sectors starting at sector into buf, returns 0 on success */
+typedef int (*gpt_read_fn)(uint32_t sector, uint32_t cnt, uint8_t *buf);
+
+typedef struct
+{
+    uint32_t first_lba;
+    uint32_t last_lba;      /* inclusive, 0 if the partition is absent */
+} gpt_part_t;
+
+typedef struct
+{
+    uint8_t valid;
+    gpt_part_t part[GPT_PART_COUNT];
+} gpt_t;
+
+/* buf holds buf_secs sectors and is only used during the scan */
+gpt_status_t
+gpt_scan(gpt_t *gpt, uint8_t *buf, uint32_t buf_secs, gpt_read_fn read);
+
+/* NULL if the table is invalid or has no partition of that type */
+const gpt_part_t *
+gpt_find(const gpt_t *gpt, gpt_part_id_t id);
+
+#endif /* _GPT_H_ */
@@ -0,0 +1,78 @@
+/*
+ * boot_trace.h
+ *
+ *  Boot stage trace ring for timing the boot without the debug UART.
+ *
+ *  Every record is a stage id, the low word of the cycle counter and one
+ *  argument. The ring lives in a .noinit section that the startup code does
+ *  not clear, so the records of the previous boot survive a warm reset and
+ *  can be read back with ESP_BOOT_TRACE once the part sits in upgrade mode.
+ *  Recording is a handful of stores, cheap enough to stay on in the ROM.
+ */
+
+#ifndef _BOOT_TRACE_H_
+#define _BOOT_TRACE_H_
+
+#include <stdint.h>
+
+#define BOOT_TRACE_RECORDS      64      /* power of 2 */
+#define BOOT_TRACE_MAGIC        0x54524342  /* "BCRT" */
+
+typedef enum
+{
+    BOOT_TRACE_START = 1,       /* main() entered, arg: boot option pin */
+    BOOT_TRACE_OPTION,          /* arg: efuse boot option */
+    BOOT_TRACE_FLASH_CHECK,     /* arg: flash_init() result */
+    BOOT_TRACE_FLASH_INVALID,   /* arg: secure boot sign mode */
+    BOOT_TRACE_SD_PROBE,        /* arg: requested bus mode */
+    BOOT_TRACE_SD_DETECT,       /* arg: card detection result */
+    BOOT_TRACE_SD_BUS,          /* arg: negotiated bus mode */
+    BOOT_TRACE_SD_PROBE_DONE,   /* arg: 1 if a valid GPT was found */
+    BOOT_TRACE_SD_BOOT,         /* arg: 0 */
+    BOOT_TRACE_SD_HEADER,       /* arg: sector after the header, 0 for a FAT file */
+    BOOT_TRACE_SD_LOADED,       /* arg: load and verify result */
+    BOOT_TRACE_SIGN_BEGIN,      /* arg: sign mode */
+    BOOT_TRACE_SIGN_HASHED,     /* arg: hashed bytes */
+    BOOT_TRACE_SIGN_DONE,       /* arg: verify result */
+    BOOT_TRACE_RUN_IMAGE,       /* arg: entry address */
+    BOOT_TRACE_UPGRADE,         /* arg: 0 */
+    BOOT_TRACE_CRC_BEGIN,       /* arg: zone size, with CRC_DONE gives the crc32 bytes per cycle */
+    BOOT_TRACE_CRC_DONE,        /* arg: 1 if the crc matched */
+    BOOT_TRACE_COPY_BEGIN,      /* arg: image bytes relocated out of the XIP window */
+    BOOT_TRACE_COPY_DONE,       /* arg: 1 if copied by DMA, 0 by memcpy */
+} boot_trace_id_t;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t cycle;
+    uint32_t arg;
+} boot_trace_rec_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t head;              /* records written since the ring was reset */
+    boot_trace_rec_t rec[BOOT_TRACE_RECORDS];
+} boot_trace_ring_t;
+
+/* keep the records of the previous boot if the ring is intact, else reset it */
+void
+boot_trace_init(void);
+
+void
+boot_trace(uint32_t id, uint32_t arg);
+
+/*
+ * Copy the records from sequence number seq on, at most max_bytes in total.
+ * buf[0] gets the sequence number of the first record copied, which is later
+ * than seq when those records were overwritten already. Returns the bytes
+ * written to buf.
+ */
+uint32_t
+boot_trace_read(uint32_t seq, uint32_t *buf, uint32_t max_bytes);
+
+uint32_t
+boot_trace_head(void);
+
+#endif /* _BOOT_TRACE_H_ */
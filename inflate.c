@@ -0,0 +1,494 @@
+/*
+ * inflate.c
+ *
+ *  Streaming raw-deflate (RFC 1951) decoder, the huffman decoding follows
+ *  the canonical code walk of zlib's contrib/puff.
+ *
+ *  Every state consumes its bits only when all of them are available, so
+ *  the decoder can stop at the end of any input chunk and resume with the
+ *  next one without buffering the compressed stream.
+ */
+
+#include <string.h>
+#include "inflate.h"
+
+enum
+{
+    ST_ZLIB = 0,
+    ST_HEADER,
+    ST_STORED_LEN,
+    ST_STORED_COPY,
+    ST_DYN_HDR,
+    ST_DYN_CLEN,
+    ST_DYN_LENS,
+    ST_DYN_REP,
+    ST_LEN_SYM,
+    ST_LITERAL,
+    ST_LEN_EXT,
+    ST_DIST_SYM,
+    ST_DIST_EXT,
+    ST_COPY,
+    ST_DONE,
+    ST_BAD,
+};
+
+#define INFLATE_SYM_MORE    (-1)
+#define INFLATE_SYM_ERROR   (-2)
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_ext[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const uint8_t dist_ext[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t clen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static void
+inflate_refill(inflate_t *s)
+{
+    while (s->bitcnt <= 24 && s->in_len) {
+        s->bitbuf |= (uint32_t)(*s->in++) << s->bitcnt;
+        s->bitcnt += 8;
+        s->in_len--;
+    }
+}
+
+static int
+inflate_need(inflate_t *s, uint32_t n)
+{
+    if (s->bitcnt < n) {
+        inflate_refill(s);
+    }
+    return s->bitcnt >= n;
+}
+
+static uint32_t
+inflate_bits(inflate_t *s, uint32_t n)
+{
+    uint32_t val = s->bitbuf & ((1UL << n) - 1);
+    s->bitbuf >>= n;
+    s->bitcnt -= n;
+    return val;
+}
+
+/* decode one symbol, nothing is consumed when the code is not complete yet */
+static int
+inflate_decode(inflate_t *s, const inflate_huffman_t *h)
+{
+    int code = 0, first = 0, index = 0, count, len;
+    uint32_t bitbuf;
+
+    inflate_refill(s);
+    bitbuf = s->bitbuf;
+    for (len = 1; len <= INFLATE_MAX_BITS; len++) {
+        if (len > s->bitcnt) {
+            return INFLATE_SYM_MORE;
+        }
+        code |= bitbuf & 1;
+        bitbuf >>= 1;
+        count = h->count[len];
+        if (code - count < first) {
+            s->bitbuf = bitbuf;
+            s->bitcnt -= len;
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return INFLATE_SYM_ERROR;
+}
+
+/* returns < 0 for an over-subscribed code, 0 for complete, > 0 for incomplete */
+static int
+inflate_build(inflate_huffman_t *h, const uint16_t *length, int n)
+{
+    int sym, len, left;
+    uint16_t offs[INFLATE_MAX_BITS + 1];
+
+    for (len = 0; len <= INFLATE_MAX_BITS; len++) {
+        h->count[len] = 0;
+    }
+    for (sym = 0; sym < n; sym++) {
+        h->count[length[sym]]++;
+    }
+    if (h->count[0] == n) {
+        return 0;
+    }
+
+    left = 1;
+    for (len = 1; len <= INFLATE_MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return left;
+        }
+    }
+
+    offs[1] = 0;
+    for (len = 1; len < INFLATE_MAX_BITS; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for (sym = 0; sym < n; sym++) {
+        if (length[sym] != 0) {
+            h->symbol[offs[length[sym]]++] = sym;
+        }
+    }
+    return left;
+}
+
+static void
+inflate_build_fixed(inflate_t *s)
+{
+    int sym;
+
+    for (sym = 0; sym < 144; sym++) {
+        s->lengths[sym] = 8;
+    }
+    for (; sym < 256; sym++) {
+        s->lengths[sym] = 9;
+    }
+    for (; sym < 280; sym++) {
+        s->lengths[sym] = 7;
+    }
+    for (; sym < INFLATE_FIX_LCODES; sym++) {
+        s->lengths[sym] = 8;
+    }
+    inflate_build(&s->lencode, s->lengths, INFLATE_FIX_LCODES);
+
+    for (sym = 0; sym < INFLATE_MAX_DCODES; sym++) {
+        s->lengths[sym] = 5;
+    }
+    inflate_build(&s->distcode, s->lengths, INFLATE_MAX_DCODES);
+}
+
+static inline void
+inflate_put(inflate_t *s, uint8_t ch)
+{
+    s->win[s->wpos++] = ch;
+    if (s->wpos == s->win_size) {
+        s->wpos = 0;
+    }
+    s->out_avail--;
+    s->total_out++;
+}
+
+void
+inflate_init(inflate_t *s, uint8_t *win, uint32_t win_size, uint8_t flags)
+{
+    memset(s, 0, sizeof(inflate_t));
+    s->win = win;
+    s->win_size = win_size;
+    s->flags = flags;
+    s->lencode.symbol = s->lensym;
+    s->distcode.symbol = s->distsym;
+    s->state = (flags & INFLATE_FLAG_ZLIB_AUTO) ? ST_ZLIB : ST_HEADER;
+}
+
+inflate_status_t
+inflate_run(inflate_t *s)
+{
+    uint32_t n;
+    int sym;
+
+    while (1) {
+        switch (s->state) {
+            case ST_ZLIB:
+                if (!inflate_need(s, 16)) {
+                    return INFLATE_NEED_INPUT;
+                }
+                n = ((s->bitbuf & 0xff) << 8) | ((s->bitbuf >> 8) & 0xff);
+                if ((n & 0x0f00) == 0x0800 && (n >> 12) <= 7 && (n % 31) == 0 && !(n & 0x20)) {
+                    inflate_bits(s, 16);
+                }
+                s->state = ST_HEADER;
+                break;
+
+            case ST_HEADER:
+                if (!inflate_need(s, 3)) {
+                    return INFLATE_NEED_INPUT;
+                }
+                s->last = inflate_bits(s, 1);
+                n = inflate_bits(s, 2);
+                if (n == 0) {
+                    /* stored block starts at a byte boundary */
+                    inflate_bits(s, s->bitcnt & 7);
+                    s->state = ST_STORED_LEN;
+                } else if (n == 1) {
+                    inflate_build_fixed(s);
+                    s->state = ST_LEN_SYM;
+                } else if (n == 2) {
+                    s->state = ST_DYN_HDR;
+                } else {
+                    s->state = ST_BAD;
+                }
+                break;
+
+            case ST_STORED_LEN:
+                if (!inflate_need(s, 32)) {
+                    return INFLATE_NEED_INPUT;
+                }
+                n = inflate_bits(s, 16);
+                if ((n ^ 0xffff) != inflate_bits(s, 16)) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                s->len = n;
+                s->state = ST_STORED_COPY;
+                break;
+
+            case ST_STORED_COPY:
+                /* whole bytes left in the accumulator go first */
+                while (s->len && s->bitcnt >= 8) {
+                    if (s->out_avail == 0) {
+                        return INFLATE_NEED_OUTPUT;
+                    }
+                    inflate_put(s, (uint8_t)inflate_bits(s, 8));
+                    s->len--;
+                }
+                while (s->len) {
+                    if (s->out_avail == 0) {
+                        return INFLATE_NEED_OUTPUT;
+                    }
+                    if (s->in_len == 0) {
+                        return INFLATE_NEED_INPUT;
+                    }
+                    n = s->len;
+                    if (n > s->in_len) {
+                        n = s->in_len;
+                    }
+                    if (n > s->out_avail) {
+                        n = s->out_avail;
+                    }
+                    if (n > s->win_size - s->wpos) {
+                        n = s->win_size - s->wpos;
+                    }
+                    memcpy(s->win + s->wpos, s->in, n);
+                    s->in += n;
+                    s->in_len -= n;
+                    s->wpos += n;
+                    if (s->wpos == s->win_size) {
+                        s->wpos = 0;
+                    }
+                    s->out_avail -= n;
+                    s->total_out += n;
+                    s->len -= n;
+                }
+                s->state = s->last ? ST_DONE : ST_HEADER;
+                break;
+
+            case ST_DYN_HDR:
+                if (!inflate_need(s, 14)) {
+                    return INFLATE_NEED_INPUT;
+                }
+                s->nlen = inflate_bits(s, 5) + 257;
+                s->ndist = inflate_bits(s, 5) + 1;
+                s->ncode = inflate_bits(s, 4) + 4;
+                if (s->nlen > INFLATE_MAX_LCODES || s->ndist > INFLATE_MAX_DCODES) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                s->idx = 0;
+                s->state = ST_DYN_CLEN;
+                break;
+
+            case ST_DYN_CLEN:
+                while (s->idx < s->ncode) {
+                    if (!inflate_need(s, 3)) {
+                        return INFLATE_NEED_INPUT;
+                    }
+                    s->lengths[clen_order[s->idx++]] = inflate_bits(s, 3);
+                }
+                while (s->idx < 19) {
+                    s->lengths[clen_order[s->idx++]] = 0;
+                }
+                if (inflate_build(&s->lencode, s->lengths, 19) != 0) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                s->idx = 0;
+                s->state = ST_DYN_LENS;
+                break;
+
+            case ST_DYN_LENS:
+                while (s->idx < s->nlen + s->ndist) {
+                    sym = inflate_decode(s, &s->lencode);
+                    if (sym == INFLATE_SYM_MORE) {
+                        return INFLATE_NEED_INPUT;
+                    }
+                    if (sym < 0) {
+                        s->state = ST_BAD;
+                        break;
+                    }
+                    if (sym < 16) {
+                        s->lengths[s->idx++] = sym;
+                    } else {
+                        s->sym = sym;
+                        s->state = ST_DYN_REP;
+                        break;
+                    }
+                }
+                if (s->state != ST_DYN_LENS) {
+                    break;
+                }
+                /* the end-of-block code must be present */
+                if (s->lengths[256] == 0
+                        || inflate_build(&s->lencode, s->lengths, s->nlen) < 0
+                        || inflate_build(&s->distcode, s->lengths + s->nlen, s->ndist) < 0) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                s->state = ST_LEN_SYM;
+                break;
+
+            case ST_DYN_REP:
+            {
+                uint16_t val = 0;
+                uint32_t rep;
+
+                n = (s->sym == 16) ? 2 : ((s->sym == 17) ? 3 : 7);
+                if (!inflate_need(s, n)) {
+                    return INFLATE_NEED_INPUT;
+                }
+                rep = inflate_bits(s, n);
+                if (s->sym == 16) {
+                    if (s->idx == 0) {
+                        s->state = ST_BAD;
+                        break;
+                    }
+                    val = s->lengths[s->idx - 1];
+                    rep += 3;
+                } else if (s->sym == 17) {
+                    rep += 3;
+                } else {
+                    rep += 11;
+                }
+                if (s->idx + rep > s->nlen + s->ndist) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                while (rep--) {
+                    s->lengths[s->idx++] = val;
+                }
+                s->state = ST_DYN_LENS;
+                break;
+            }
+
+            case ST_LEN_SYM:
+                /* output space is only needed for a literal or a match, the
+                 * end-of-block code is still taken once the output is full */
+                while (1) {
+                    sym = inflate_decode(s, &s->lencode);
+                    if (sym == INFLATE_SYM_MORE) {
+                        return INFLATE_NEED_INPUT;
+                    }
+                    if (sym < 256) {
+                        if (sym < 0) {
+                            s->state = ST_BAD;
+                            break;
+                        }
+                        if (s->out_avail == 0) {
+                            s->sym = sym;
+                            s->state = ST_LITERAL;
+                            break;
+                        }
+                        inflate_put(s, (uint8_t)sym);
+                        continue;
+                    }
+                    if (sym == 256) {
+                        s->state = s->last ? ST_DONE : ST_HEADER;
+                        break;
+                    }
+                    sym -= 257;
+                    if (sym >= 29) {
+                        s->state = ST_BAD;
+                        break;
+                    }
+                    s->sym = sym;
+                    s->state = ST_LEN_EXT;
+                    break;
+                }
+                break;
+
+            case ST_LITERAL:
+                if (s->out_avail == 0) {
+                    return INFLATE_NEED_OUTPUT;
+                }
+                inflate_put(s, (uint8_t)s->sym);
+                s->state = ST_LEN_SYM;
+                break;
+
+            case ST_LEN_EXT:
+                if (!inflate_need(s, len_ext[s->sym])) {
+                    return INFLATE_NEED_INPUT;
+                }
+                s->len = len_base[s->sym] + inflate_bits(s, len_ext[s->sym]);
+                s->state = ST_DIST_SYM;
+                break;
+
+            case ST_DIST_SYM:
+                sym = inflate_decode(s, &s->distcode);
+                if (sym == INFLATE_SYM_MORE) {
+                    return INFLATE_NEED_INPUT;
+                }
+                if (sym < 0 || sym >= INFLATE_MAX_DCODES) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                s->sym = sym;
+                s->state = ST_DIST_EXT;
+                break;
+
+            case ST_DIST_EXT:
+                if (!inflate_need(s, dist_ext[s->sym])) {
+                    return INFLATE_NEED_INPUT;
+                }
+                s->dist = dist_base[s->sym] + inflate_bits(s, dist_ext[s->sym]);
+                if (s->dist > s->total_out || s->dist > s->win_size) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                s->state = ST_COPY;
+                break;
+
+            case ST_COPY:
+            {
+                uint32_t from = (s->wpos + s->win_size - s->dist) % s->win_size;
+
+                while (s->len) {
+                    if (s->out_avail == 0) {
+                        return INFLATE_NEED_OUTPUT;
+                    }
+                    inflate_put(s, s->win[from]);
+                    if (++from == s->win_size) {
+                        from = 0;
+                    }
+                    s->len--;
+                }
+                s->state = ST_LEN_SYM;
+                break;
+            }
+
+            case ST_DONE:
+                return INFLATE_DONE;
+
+            default:
+                s->state = ST_BAD;
+                return INFLATE_ERROR;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * inflate.h
+ *
+ *  Streaming raw-deflate (RFC 1951) decoder for ESP_FLASH_DEFLATED_DATA.
+ *
+ *  The decoder is resumable at any input byte: it stops with INFLATE_NEED_INPUT
+ *  when the current SLIP frame is used up and with INFLATE_NEED_OUTPUT when the
+ *  caller granted no more output space. Output is written into a caller owned
+ *  circular window which is also used for back references, so the window must
+ *  keep at least the last 32KB of output untouched.
+ */
+
+#ifndef _INFLATE_H_
+#define _INFLATE_H_
+
+#include <stdint.h>
+
+#define INFLATE_MAX_BITS        15
+#define INFLATE_MAX_LCODES      286
+#define INFLATE_MAX_DCODES      30
+#define INFLATE_FIX_LCODES      288
+#define INFLATE_MAX_DIST        32768
+
+/* skip a zlib (RFC 1950) wrapper when the stream starts with one, like esptool sends */
+#define INFLATE_FLAG_ZLIB_AUTO  0x01
+
+typedef enum
+{
+    INFLATE_DONE = 0,
+    INFLATE_NEED_INPUT,
+    INFLATE_NEED_OUTPUT,
+    INFLATE_ERROR = -1,
+} inflate_status_t;
+
+typedef struct
+{
+    uint16_t count[INFLATE_MAX_BITS + 1];
+    uint16_t *symbol;
+} inflate_huffman_t;
+
+typedef struct
+{
+    /* input of the current call */
+    const uint8_t *in;
+    uint32_t in_len;
+
+    /* output window, out_avail bytes may be written at wpos */
+    uint8_t *win;
+    uint32_t win_size;
+    uint32_t wpos;
+    uint32_t out_avail;
+    uint32_t total_out;
+
+    /* bit accumulator */
+    uint32_t bitbuf;
+    uint32_t bitcnt;
+
+    /* decoder state */
+    uint8_t state;
+    uint8_t last;
+    uint8_t flags;
+    uint16_t nlen, ndist, ncode, idx;
+    uint16_t len;
+    uint16_t dist;
+    uint16_t sym;
+
+    inflate_huffman_t lencode;
+    inflate_huffman_t distcode;
+    uint16_t lensym[INFLATE_FIX_LCODES];
+    uint16_t distsym[INFLATE_MAX_DCODES];
+    uint16_t lengths[INFLATE_FIX_LCODES + INFLATE_MAX_DCODES];
+} inflate_t;
+
+void
+inflate_init(inflate_t *s, uint8_t *win, uint32_t win_size, uint8_t flags);
+
+/* run until input is consumed, out_avail is used up, the stream ends or an error occurs */
+inflate_status_t
+inflate_run(inflate_t *s);
+
+#endif /* _INFLATE_H_ */
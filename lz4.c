@@ -0,0 +1,157 @@
+/*
+ * lz4.c
+ *
+ *  Streaming LZ4 block (not frame) decoder, see lz4.h.
+ *
+ *  A sequence is a token, optional literal length bytes, the literals, a
+ *  little endian 16-bit offset and optional match length bytes. The block
+ *  ends with a literal-only sequence, which is recognised by the output
+ *  reaching out_size.
+ */
+
+#include <string.h>
+#include "lz4.h"
+
+enum
+{
+    ST_TOKEN = 0,
+    ST_LIT_LEN,
+    ST_LIT,
+    ST_OFF_LO,
+    ST_OFF_HI,
+    ST_MATCH_LEN,
+    ST_MATCH,
+    ST_DONE,
+    ST_BAD,
+};
+
+static void
+lz4_match(lz4_t *s)
+{
+    uint8_t *dst = s->out + s->total_out;
+    const uint8_t *src = dst - s->off;
+    uint32_t n = s->mlen;
+
+    /* an offset shorter than the length repeats the last off bytes */
+    if (s->off >= n) {
+        memcpy(dst, src, n);
+    } else {
+        while (n--) {
+            *dst++ = *src++;
+        }
+    }
+    s->total_out += s->mlen;
+}
+
+void
+lz4_init(lz4_t *s, uint8_t *out, uint32_t out_size)
+{
+    memset(s, 0, sizeof(lz4_t));
+    s->out = out;
+    s->out_size = out_size;
+    s->state = (out_size == 0) ? ST_DONE : ST_TOKEN;
+}
+
+lz4_status_t
+lz4_run(lz4_t *s)
+{
+    uint32_t n, b;
+
+    while (1) {
+        switch (s->state) {
+            case ST_TOKEN:
+                if (s->in_len == 0) {
+                    return LZ4_NEED_INPUT;
+                }
+                b = *s->in++;
+                s->in_len--;
+                s->lit = b >> 4;
+                s->mlen = b & 0x0f;
+                s->state = (s->lit == 0x0f) ? ST_LIT_LEN : ST_LIT;
+                break;
+
+            case ST_LIT_LEN:
+                if (s->in_len == 0) {
+                    return LZ4_NEED_INPUT;
+                }
+                b = *s->in++;
+                s->in_len--;
+                s->lit += b;
+                if (b != 0xff) {
+                    s->state = ST_LIT;
+                }
+                break;
+
+            case ST_LIT:
+                if (s->lit > s->out_size - s->total_out) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                while (s->lit) {
+                    if (s->in_len == 0) {
+                        return LZ4_NEED_INPUT;
+                    }
+                    n = (s->lit > s->in_len) ? s->in_len : s->lit;
+                    /* the input may sit just above the output when decoding in place */
+                    memmove(s->out + s->total_out, s->in, n);
+                    s->in += n;
+                    s->in_len -= n;
+                    s->total_out += n;
+                    s->lit -= n;
+                }
+                s->state = (s->total_out == s->out_size) ? ST_DONE : ST_OFF_LO;
+                break;
+
+            case ST_OFF_LO:
+                if (s->in_len == 0) {
+                    return LZ4_NEED_INPUT;
+                }
+                s->off = *s->in++;
+                s->in_len--;
+                s->state = ST_OFF_HI;
+                break;
+
+            case ST_OFF_HI:
+                if (s->in_len == 0) {
+                    return LZ4_NEED_INPUT;
+                }
+                s->off |= (uint32_t)*s->in++ << 8;
+                s->in_len--;
+                if (s->off == 0 || s->off > s->total_out) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                s->state = (s->mlen == 0x0f) ? ST_MATCH_LEN : ST_MATCH;
+                break;
+
+            case ST_MATCH_LEN:
+                if (s->in_len == 0) {
+                    return LZ4_NEED_INPUT;
+                }
+                b = *s->in++;
+                s->in_len--;
+                s->mlen += b;
+                if (b != 0xff) {
+                    s->state = ST_MATCH;
+                }
+                break;
+
+            case ST_MATCH:
+                s->mlen += LZ4_MIN_MATCH;
+                if (s->mlen > s->out_size - s->total_out) {
+                    s->state = ST_BAD;
+                    break;
+                }
+                lz4_match(s);
+                s->state = ST_TOKEN;
+                break;
+
+            case ST_DONE:
+                return LZ4_DONE;
+
+            case ST_BAD:
+            default:
+                return LZ4_ERROR;
+        }
+    }
+}
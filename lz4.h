@@ -0,0 +1,56 @@
+/*
+ * lz4.h
+ *
+ *  Streaming LZ4 block decoder for compressed boot images.
+ *
+ *  Output goes straight into the final image in RAM, so matches are copied
+ *  from what was written before and no window is needed. Input may be handed
+ *  over in chunks of any size: a token, length or offset split across two
+ *  chunks is picked up again from the saved state.
+ *
+ *  Decoding in place is safe when the compressed block ends at least
+ *  LZ4_INPLACE_MARGIN() bytes after the end of the output, the write
+ *  position then never passes the read position.
+ */
+
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+#include <stdint.h>
+
+#define LZ4_MIN_MATCH           4
+#define LZ4_INPLACE_MARGIN(n)   (((n) >> 8) + 32)
+
+typedef enum
+{
+    LZ4_DONE = 0,
+    LZ4_NEED_INPUT,
+    LZ4_ERROR = -1,
+} lz4_status_t;
+
+typedef struct
+{
+    /* input of the current call */
+    const uint8_t *in;
+    uint32_t in_len;
+
+    /* linear output, out_size bytes are expected */
+    uint8_t *out;
+    uint32_t out_size;
+    uint32_t total_out;
+
+    /* decoder state */
+    uint8_t state;
+    uint32_t lit;
+    uint32_t mlen;
+    uint32_t off;
+} lz4_t;
+
+void
+lz4_init(lz4_t *s, uint8_t *out, uint32_t out_size);
+
+/* run until the input is consumed, out_size bytes are decoded or an error occurs */
+lz4_status_t
+lz4_run(lz4_t *s);
+
+#endif /* _LZ4_H_ */
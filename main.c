@@ -22,6 +22,11 @@
 #include "ftsdc021.h"
 #include "secure.h"
 #include "Driver_CRYPTO.h"
+#include "fat.h"
+#include "gpt.h"
+#include "dma.h"
+#include "lz4.h"
+#include "boot_trace.h"
 
 
 #define PIN_BOOT_OPT                 3        // GPIOA_03
@@ -52,8 +57,19 @@ volatile uint32_t rom_code_version = ROM_CODE_VERSION;
 
 #define BOOT_HEADER_MASK			0xFC000000
 
+#define SD_ADMA_BUF 	(ADMA2_NUM_OF_LINES * sizeof(Adma2DescTable))
+#define SD_BULK_BLKS	(128) // 64K per CMD18, one ADMA2 descriptor line
+
 static _DMA32 uint8_t  SourceBuf[SD_BLK_SZ] = {0};
 static _DMA32 uint8_t  FTSDC021_SD_CARD_BUF[SD_CARD_BUF];
+static _DMA32 uint8_t  FTSDC021_SD_ADMA_BUF[SD_ADMA_BUF];
+
+extern u32 gm_sdc_api_sdcard_bulk_read(u8 ip_idx, u32 sector, u32 cnt, void* buff);
+extern u32 gm_sdc_api_negotiate_bus(u8 ip_idx, u8 width, u8 speed, void* buf);
+extern uint32_t crc32(uint32_t val, const uint8_t *buf, size_t len);
+
+// bus width in bits 0~7 and bus speed in bits 8~15 reached by the last sd_card_probe()
+uint32_t sd_bus_mode = 0;
 
 static void iomux_sel_sdc();
 
@@ -132,7 +148,12 @@ bool flash_ota_header(ls_ota_header_t *boot_header, int sign_mode, int ota_heade
         }
         else if(sign_mode == OTA_SIGN_CRC32)
         {
-            if(!ota_check_zone_crc(boot_header))
+            bool crc_ok;
+
+            boot_trace(BOOT_TRACE_CRC_BEGIN, boot_header->size);
+            crc_ok = ota_check_zone_crc(boot_header);
+            boot_trace(BOOT_TRACE_CRC_DONE, crc_ok);
+            if(!crc_ok)
                 return false;
         }
         else
@@ -183,7 +204,10 @@ bool flash_ota_header(ls_ota_header_t *boot_header, int sign_mode, int ota_heade
 
 bool flash_img_is_valid(uint8_t *buf)
 {
-	if(flash_init(&flash_dev, FLASH_SPI_IGNORE_QE | FLASH_SPI_RELEASE_DPD, 0) != 0)
+	int ret = flash_init(&flash_dev, FLASH_SPI_IGNORE_QE | FLASH_SPI_RELEASE_DPD, 0);
+
+	boot_trace(BOOT_TRACE_FLASH_CHECK, ret);
+	if(ret != 0)
 	{
 		return false;
 	}
@@ -212,6 +236,7 @@ bool flash_img_is_valid(uint8_t *buf)
     boot_header = (ls_ota_header_t *)(AP_FLASH_BASE);
     flash_ota_header(boot_header, sign_mode, ota_header_offset);
 
+	boot_trace(BOOT_TRACE_FLASH_INVALID, sign_mode);
 	return false;
 }
 
@@ -262,6 +287,7 @@ PROCESS_THREAD(led_process, ev, data)
 
 void run_image(uint8_t *addr)
 {
+    boot_trace(BOOT_TRACE_RUN_IMAGE, (uint32_t)addr);
     disable_GINT();
     // disable interrupts and systick exception
     disable_IRQ(IRQ_Timer_VECTOR);
@@ -297,16 +323,91 @@ void run_image(uint8_t *addr)
     enable_GINT();
 }
 
+static volatile uint8_t flash_copy_done;
+static volatile uint32_t flash_copy_event;
+
+static void flash_copy_dma_cb(uint32_t event, uint32_t xfer_bytes, uint32_t usr_param)
+{
+	flash_copy_event = event & 0xFF;
+	flash_copy_done = 1;
+}
+
+// a DMA copy slower than this is taken as stuck, far below what the XIP window delivers
+#define FLASH_COPY_CYCLES_PER_BYTE	64
+
+// relocate the image out of the XIP window by DMA, D-cache is off so a CPU copy
+// pays a bus round trip per word. The CPU only waits for the one transfer, it is
+// not overlapped with other work. Falls back to memcpy if no channel is free or
+// the transfer doesn't complete in time. COPY_BEGIN/COPY_DONE in the boot trace
+// give the copy time on target
+static void flash_copy_image(uint8_t *dst, const uint8_t *src, uint32_t size)
+{
+	uint8_t ch = DMA_CHANNEL_ANY;
+	uint32_t by_dma = 0;
+	uint64_t cycles = __get_rv_cycle();
+	uint64_t limit = cycles + 0x10000 + (uint64_t)size * FLASH_COPY_CYCLES_PER_BYTE;
+
+	boot_trace(BOOT_TRACE_COPY_BEGIN, size);
+	dma_initialize();
+	flash_copy_done = 0;
+	if(dma_channel_select(&ch, flash_copy_dma_cb, 0, DMA_CACHE_SYNC_NOP) == DMA_CHANNEL_ANY ||
+			dma_memcpy(ch, (uint32_t)src, (uint32_t)dst, size) != 0)
+	{
+		if(ch != DMA_CHANNEL_ANY)
+			dma_channel_disable(ch, 0);
+		memcpy(dst, src, size);
+	}
+	else
+	{
+		while(!flash_copy_done && __get_rv_cycle() < limit);
+		if(!flash_copy_done)
+			dma_channel_disable(ch, 0);
+		if(!flash_copy_done || flash_copy_event != DMA_EVENT_TRANSFER_COMPLETE)
+			memcpy(dst, src, size);
+		else
+			by_dma = 1;
+	}
+	dma_uninitialize();
+	boot_trace(BOOT_TRACE_COPY_DONE, by_dma);
+
+	BOOT_LOG("image copy %u bytes, %u cycles\r\n", size, (uint32_t)(__get_rv_cycle() - cycles));
+}
+
 #define IMG_VMA_OFFSET   (IMG_HDR_POS + 8)
 #define IMG_SIZE_OFFSET  (IMG_HDR_POS + 4)
+#define IMG_FLAGS_OFFSET (IMG_HDR_POS + 15)
+// reserve[0], the unpacked size of an IMG_FLAG_LZ4 image
+#define IMG_RAW_SIZE_OFFSET (IMG_HDR_POS + 32)
+// unpack an IMG_FLAG_LZ4 image straight out of the XIP window
+static int flash_unpack_image(uint8_t *dst, const uint8_t *src, uint32_t size, uint32_t raw_size)
+{
+	lz4_t lz4;
+
+	if(size <= IMG_LZ4_HEAD || raw_size <= IMG_LZ4_HEAD)
+		return -1;
+
+	flash_copy_image(dst, src, IMG_LZ4_HEAD);
+
+	lz4_init(&lz4, dst + IMG_LZ4_HEAD, raw_size - IMG_LZ4_HEAD);
+	lz4.in = src + IMG_LZ4_HEAD;
+	lz4.in_len = size - IMG_LZ4_HEAD;
+
+	return (lz4_run(&lz4) == LZ4_DONE) ? 0 : -1;
+}
+
 void boot_flash()
 {
 	uint32_t vma, size;
 
 	vma = *(uint32_t *)(AP_FLASH_BASE + IMG_VMA_OFFSET);
 	size = *(uint32_t *)(AP_FLASH_BASE + IMG_SIZE_OFFSET);
-	if(vma != AP_FLASH_BASE) {  //need code copy
-		memcpy((uint8_t *)vma, (uint8_t *)AP_FLASH_BASE, size);
+	if(*(uint8_t *)(AP_FLASH_BASE + IMG_FLAGS_OFFSET) & IMG_FLAG_LZ4) {
+		// a compressed image can't run in place
+		if(vma == AP_FLASH_BASE || flash_unpack_image((uint8_t *)vma, (uint8_t *)AP_FLASH_BASE,
+				size, *(uint32_t *)(AP_FLASH_BASE + IMG_RAW_SIZE_OFFSET)))
+			return;
+	} else if(vma != AP_FLASH_BASE) {  //need code copy
+		flash_copy_image((uint8_t *)vma, (uint8_t *)AP_FLASH_BASE, size);
 	}
 	run_image((uint8_t *)vma); //never return
 }
@@ -358,24 +459,345 @@ uint32_t read_partition_table(uint8_t *mbr_data) {
     return 0;
 }
 
+// read cnt sectors into buf, whole sectors go by multi-block DMA
+static int sd_read_blocks(uint32_t sector, uint32_t cnt, uint8_t *buf)
+{
+	uint32_t n;
+	int retry;
+
+	while(cnt)
+	{
+		n = (cnt > SD_BULK_BLKS) ? SD_BULK_BLKS : cnt;
+
+		retry = 5;
+		while(gm_sdc_api_sdcard_bulk_read(SD_0, sector, n, buf))
+		{
+			if(retry == 0)
+				return -1;
+			retry--;
+		}
+		sector += n;
+		buf += n * SD_BLK_SZ;
+		cnt -= n;
+	}
+
+	return 0;
+}
+
+#define SD_BOOT_FILE	"/BOOT.BIN"
+
+static _DMA32 uint8_t  FatWin[SD_BLK_SZ];
+static fat_t sd_fat;
+static fat_file_t sd_boot_file;
+static fat_file_t *sd_boot_fp = NULL;
+
+gpt_t sd_gpt;
+
+// first LBA of the first GPT boot partition (plain, A, then B), 0 if none
+static uint32_t sd_gpt_boot_lba()
+{
+	const gpt_part_t *part;
+	int id;
+
+	for (id = GPT_PART_BOOT; id <= GPT_PART_BOOT_B; id++) {
+		part = gpt_find(&sd_gpt, (gpt_part_id_t)id);
+		if(part)
+			return part->first_lba;
+	}
+
+	return 0;
+}
+
+static int sd_mount_boot_file(uint32_t lba)
+{
+	if(fat_mount(&sd_fat, lba, FatWin, sd_read_blocks) != FAT_OK ||
+			fat_open(&sd_fat, &sd_boot_file, SD_BOOT_FILE) != FAT_OK)
+		return -1;
+
+	BOOT_LOG("%s found at sector %u, %u bytes\r\n", SD_BOOT_FILE, lba, sd_boot_file.size);
+	sd_boot_fp = &sd_boot_file;
+	return 0;
+}
+
+// look for SD_BOOT_FILE on the GPT boot/data or MBR FAT partitions, then on a card without partition table
+static int sd_open_boot_file(uint8_t *mbr_data)
+{
+	const gpt_part_t *part;
+	uint8_t *entry_ptr;
+	uint32_t lba;
+	int i;
+
+	sd_boot_fp = NULL;
+	if(sd_gpt.valid) {
+		for (i = GPT_PART_BOOT; i < GPT_PART_COUNT; i++) {
+			part = gpt_find(&sd_gpt, (gpt_part_id_t)i);
+			if(part && sd_mount_boot_file(part->first_lba) == 0)
+				return 0;
+		}
+		return -1;
+	}
+
+	for (i = 0; i < 4; i++) {
+		if(mbr_data[0x1FE] != 0x55 || mbr_data[0x1FF] != 0xAA)
+			break;
+
+		entry_ptr = mbr_data + PARTITION_TABLE_OFFSET + i * PARTITION_ENTRY_SIZE;
+		// FAT16 (0x04, 0x06, 0x0E) or FAT32 (0x0B, 0x0C)
+		if(entry_ptr[4] != 0x04 && entry_ptr[4] != 0x06 && entry_ptr[4] != 0x0E &&
+				entry_ptr[4] != 0x0B && entry_ptr[4] != 0x0C)
+			continue;
+		lba = entry_ptr[8] | (entry_ptr[9] << 8) | (entry_ptr[10] << 16) | (entry_ptr[11] << 24);
+		if(sd_mount_boot_file(lba) == 0)
+			return 0;
+	}
+
+	return sd_mount_boot_file(0);
+}
+
+#define SD_LOAD_CHUNK	(SD_BULK_BLKS * SD_BLK_SZ)
+// images must stay below the SLIP buffers
+#define SD_IMAGE_LIMIT	(AP_RX_BUF_BASE)
+
+// image check fed by the load loop, so the secure path needs no second pass over RAM
+typedef struct
+{
+	int sign_mode;
+	ls_ota_header_t *hdr;	// the header at vma, stored as is even in a compressed image
+	uint32_t done;			// bytes of the image checked so far, 0 until the header is in
+	uint32_t sum;			// running crc32, or the ota_check_sum() xor
+	uint32_t tail;			// the word after the image, ota_check_sum() takes it for a 1KB multiple size
+} sd_verify_t;
+
+// check the next len bytes of the image, the hash engine keeps working on them while the next chunk is read
+static int sd_verify_chunk(sd_verify_t *v, const uint8_t *data, uint32_t len, int last)
+{
+	ls_ota_header_t *hdr = v->hdr;
+	uint32_t off;
+
+	// the header and the sign area always arrive with the first chunk
+	if(v->done == 0)
+	{
+		off = 0;
+		if(v->sign_mode == OTA_SIGN_CRC32)
+		{
+			v->sum = ota_zone_header_crc(hdr);
+			off = sizeof(ls_ota_header_t);
+		}
+		else if(v->sign_mode != OTA_SIGN_NONE &&
+				secure_verify_begin(hdr, v->sign_mode, &off) != CSK_DRIVER_OK)
+			return -1;
+
+		if(len < off)
+			return -1;
+		data += off;
+		len -= off;
+		v->done = off;
+	}
+
+	if(v->sign_mode == OTA_SIGN_NONE)
+	{
+		v->sum = ota_check_sum_update(v->sum, hdr->size, v->done, data, len);
+		v->done += len;
+		if(last)
+			v->sum = ota_check_sum_update(v->sum, hdr->size, v->done, (const uint8_t *)&v->tail, 4);
+		return (!last || v->sum == hdr->checksum) ? 0 : -1;
+	}
+
+	if(v->sign_mode == OTA_SIGN_CRC32)
+	{
+		v->sum = crc32(v->sum, data, len);
+		v->done += len;
+		return (!last || v->sum == hdr->crc32) ? 0 : -1;
+	}
+
+	if(last)
+	{
+		if(len == 0 || secure_verify_end(hdr, v->sign_mode, data, len) != CSK_DRIVER_OK)
+			return -1;
+	}
+	else if(secure_verify_update(data, len) != CSK_DRIVER_OK)
+		return -1;
+	v->done += len;
+
+	return 0;
+}
+
+typedef struct
+{
+	uint32_t sector;		// next sector of a raw image, the boot file keeps its own position
+	uint32_t left;			// image bytes still to read
+	sd_verify_t *verify;	// NULL if nothing is checked while loading
+	lz4_t *lz4;				// NULL if the image is stored as is
+	const uint8_t *pend;	// compressed chunk read and checked but not unpacked yet
+	uint32_t pend_len;
+} sd_load_t;
+
+// unpack the pending chunk, its hash is done once the next chunk has been handed to the engine
+static int sd_unpack_pending(sd_load_t *ld)
+{
+	if(ld->pend_len == 0)
+		return 0;
+
+	ld->lz4->in = ld->pend;
+	ld->lz4->in_len = ld->pend_len;
+	ld->pend_len = 0;
+
+	return (lz4_run(ld->lz4) == LZ4_ERROR) ? -1 : 0;
+}
+
+// read the word after the image into the check, erased flash if the boot file ends there
+static int sd_load_tail(sd_load_t *ld)
+{
+	uint32_t *tail = &ld->verify->tail;
+
+	*tail = 0xffffffff;
+	// ota_check_sum() only samples it for a 1KB multiple size up to 32KB
+	if(ld->verify->sign_mode != OTA_SIGN_NONE ||
+			(ld->verify->hdr->size & 1023) || ld->verify->hdr->size > 32 * 1024)
+		return 0;
+
+	if(sd_boot_fp)
+		return (fat_read(sd_boot_fp, (uint8_t *)tail, 4) < 0) ? -1 : 0;
+
+	if(sd_read_blocks(ld->sector, 1, SourceBuf))
+		return -1;
+	memcpy(tail, SourceBuf, 4);
+	return 0;
+}
+
+// read len bytes of the image into buf, vpos..buf is already loaded but not checked yet
+static int sd_load_region(sd_load_t *ld, const uint8_t *vpos, uint8_t *buf, uint32_t len)
+{
+	uint32_t n, blks;
+
+	while(len > 0)
+	{
+		n = (len > SD_LOAD_CHUNK) ? SD_LOAD_CHUNK : len;
+
+		if(sd_boot_fp)
+		{
+			if(fat_read(sd_boot_fp, buf, n) != (int32_t)n)
+				return -1;
+		}
+		else
+		{
+			blks = n / SD_BLK_SZ;
+			if(blks && sd_read_blocks(ld->sector, blks, buf))
+				return -1;
+
+			// the tail is staged so nothing beyond the image gets overwritten
+			if(n & (SD_BLK_SZ - 1))
+			{
+				if(sd_read_blocks(ld->sector + blks, 1, SourceBuf))
+					return -1;
+				memcpy(buf + blks * SD_BLK_SZ, SourceBuf, n & (SD_BLK_SZ - 1));
+			}
+			ld->sector += blks;
+		}
+
+		buf += n;
+		len -= n;
+		ld->left -= n;
+
+		if(ld->verify && ld->left == 0 && sd_load_tail(ld))
+			return -1;
+		if(ld->verify && sd_verify_chunk(ld->verify, vpos, buf - vpos, ld->left == 0))
+			return -1;
+		if(ld->lz4)
+		{
+			if(sd_unpack_pending(ld))
+				return -1;
+			ld->pend = vpos;
+			ld->pend_len = buf - vpos;
+		}
+		vpos = buf;
+	}
+
+	return 0;
+}
+
+/*
+ * load a size byte image to dst, its first SD_BLK_SZ bytes are in SourceBuf and
+ * sector follows them. raw_size != 0 marks a compressed image: the first IMG_LZ4_HEAD
+ * bytes are stored as is, the LZ4 block after them is read to the end of the
+ * unpacked image (plus the in-place margin) and unpacked there one chunk behind
+ * the reads. The check sees the bytes as stored.
+ */
+static int sd_load_image(uint32_t sector, uint8_t *dst, int32_t size, uint32_t raw_size, sd_verify_t *v)
+{
+	sd_load_t ld = { .sector = sector, .left = size, .verify = v };
+	lz4_t lz4;
+	uint8_t *stage;
+	uint32_t head, packed;
+
+	head = IMG_LZ4_HEAD;
+	if(size <= 0 || (raw_size && (size <= head || raw_size <= head)))
+		return -1;
+
+	// the 1st block has been loaded ahead
+	memcpy(dst, SourceBuf, SD_BLK_SZ);
+	if(size <= SD_BLK_SZ)
+		return v ? sd_verify_chunk(v, dst, size, 1) : 0;
+	ld.left -= SD_BLK_SZ;
+
+	if(raw_size == 0)
+		return sd_load_region(&ld, dst, dst + SD_BLK_SZ, size - SD_BLK_SZ);
+
+	packed = size - head;
+
+	// 32-byte alignment only moves the block further up, i.e. away from the output
+	stage = (uint8_t *)(((uint32_t)dst + raw_size + LZ4_INPLACE_MARGIN(packed) - packed + 31) & ~31UL);
+	if(stage < dst + head || (uint32_t)stage + packed > SD_IMAGE_LIMIT)
+		return -1;
+
+	if(sd_load_region(&ld, dst, dst + SD_BLK_SZ, head - SD_BLK_SZ))
+		return -1;
+
+	lz4_init(&lz4, dst + head, raw_size - head);
+	ld.lz4 = &lz4;
+	if(sd_load_region(&ld, stage, stage, packed))
+		return -1;
+
+	// the last chunk has been checked in full above
+	if(sd_unpack_pending(&ld))
+		return -1;
+
+	return (lz4_run(&lz4) == LZ4_DONE) ? 0 : -1;
+}
+
 void boot_sdcard()
 {
 #define SDCARD_IMAGE_OFFSET_SECTOR (64 * 2) // 64K
-	uint32_t vma;
+	uint32_t vma, raw_size;
 	int32_t size;
 	uint32_t sector;
+	int ret;
+
+	boot_trace(BOOT_TRACE_SD_BOOT, 0);
 
 	// Read and parse the partition table
 	gm_sdc_api_sdcard_sector_read(SD_0, 0, 1, SourceBuf);
-	sector = read_partition_table(SourceBuf);
 
-	// If no valid boot partition found, set to 64KB
-	if(sector == 0)
-		sector = SDCARD_IMAGE_OFFSET_SECTOR;
+	// prefer the boot file on a FAT volume, then the raw image
+	if(sd_open_boot_file(SourceBuf) == 0)
+	{
+		sector = 0;
+		if(fat_read(sd_boot_fp, SourceBuf, SD_BLK_SZ) != SD_BLK_SZ)
+			return;
+	}
+	else
+	{
+		sector = sd_gpt.valid ? sd_gpt_boot_lba() : read_partition_table(SourceBuf);
 
-	if(gm_sdc_api_sdcard_sector_read(SD_0, sector, 1, SourceBuf))
-		return;
-	sector++;
+		// If no valid boot partition found, set to 64KB
+		if(sector == 0)
+			sector = SDCARD_IMAGE_OFFSET_SECTOR;
+
+		if(gm_sdc_api_sdcard_sector_read(SD_0, sector, 1, SourceBuf))
+			return;
+		sector++;
+	}
+	boot_trace(BOOT_TRACE_SD_HEADER, sector);
 
 	int sign_mode=efuse_boot_secure_enable();
 
@@ -386,29 +808,13 @@ void boot_sdcard()
 		{
 			vma = *(uint32_t *)(&SourceBuf[IMG_VMA_OFFSET]);
 			size = *(uint32_t *)(&SourceBuf[IMG_SIZE_OFFSET]);
-			//need code copy
-			uint8_t *pMem = (uint8_t *)vma;
-
-			// the 1st block has been loaded ahead
-			memcpy(pMem, SourceBuf, SD_BLK_SZ);
-			pMem += SD_BLK_SZ;
-			size -= SD_BLK_SZ;
-
-			while(size > 0)
-			{
-				int retry = 5;
-				while(gm_sdc_api_sdcard_sector_read(SD_0, sector, 1, SourceBuf))
-				{
-					if(retry == 0)
-						return;
-					retry--;
-				}
-				sector++;
+			raw_size = (SourceBuf[IMG_FLAGS_OFFSET] & IMG_FLAG_LZ4) ? *(uint32_t *)(&SourceBuf[IMG_RAW_SIZE_OFFSET]) : 0;
 
-				memcpy(pMem, SourceBuf, ((size > SD_BLK_SZ) ? SD_BLK_SZ : size));
-				pMem += SD_BLK_SZ;
-				size -= SD_BLK_SZ;
-			}
+			//need code copy
+			ret = sd_load_image(sector, (uint8_t *)vma, size, raw_size, NULL);
+			boot_trace(BOOT_TRACE_SD_LOADED, ret);
+			if(ret)
+				return;
 
 			run_image((uint8_t *)vma); //never return
 		}
@@ -422,57 +828,25 @@ void boot_sdcard()
 	{
 		vma = boot_header->address;
 		size = boot_header->size;
+		raw_size = (boot_header->flags & OTA_ZIP_MASK) ? OTA_ZIP_RAW_SIZE(boot_header) : 0;
 
-		if((vma + size) > 0x200A0000)
+		if((vma + (raw_size ? raw_size : size)) > SD_IMAGE_LIMIT)
 			return;
 
-		//need code copy
-		uint8_t *pMem = (uint8_t *)vma;
-		// the 1st block has been loaded ahead
-		memcpy(pMem, SourceBuf, SD_BLK_SZ);
-		pMem += SD_BLK_SZ;
-		size -= SD_BLK_SZ;
+		// checksum, crc32 or signature is checked chunk by chunk while loading
+		sd_verify_t verify = { .sign_mode = sign_mode, .hdr = (ls_ota_header_t *)vma, .done = 0, .sum = 0 };
 
-		while(size > 0)
-		{
-			int retry = 5;
-			while(gm_sdc_api_sdcard_sector_read(SD_0, sector, 1, SourceBuf))
-			{
-				if(retry == 0)
-					return;
-				retry--;
-			}
-			sector++;
-
-			memcpy(pMem, SourceBuf, ((size > SD_BLK_SZ) ? SD_BLK_SZ : size));
-			pMem += SD_BLK_SZ;
-			size -= SD_BLK_SZ;
-		}
+		if(sign_mode > OTA_SIGN_CRC32)
+			secure_init();
+		ret = sd_load_image(sector, (uint8_t *)vma, size, raw_size, &verify);
+		if(sign_mode > OTA_SIGN_CRC32)
+			secure_shutdown();
+		boot_trace(BOOT_TRACE_SD_LOADED, ret);
+		if(ret)
+			return;
 
 		boot_header = (ls_ota_header_t*)vma;
 
-		if(OTA_SIGN_NONE == sign_mode)
-		{
-            if(!ota_check_sum(boot_header))
-                return;
-		}
-		else if(sign_mode == OTA_SIGN_CRC32)
-	    {
-            if(!ota_check_zone_crc(boot_header))
-                return;
-	    }
-		else
-        {
-            extern void* CRYPTO0_Handler;
-            secure_init();
-            if(CSK_DRIVER_OK != CRYPTO_Verify_Flash_Signature(CRYPTO0_Handler, boot_header, sign_mode))
-            {
-				secure_shutdown();
-                return;
-            }
-            secure_shutdown();
-        }
-
         run_image((uint8_t *)boot_header->entry); //never return
 	}
 	return;
@@ -496,6 +870,7 @@ void contiki_init()
 void upgrade()
 {
 	uint8_t r;
+	boot_trace(BOOT_TRACE_UPGRADE, 0);
 	flash_init(&flash_dev, 0, 0);
     contiki_init();
 
@@ -579,10 +954,12 @@ int main( void )
 
 	bool valid;
 	uint8_t *buf = (uint8_t *)SLIP_RX_BUF;
-	int32_t boot_ops;
+	int32_t boot_ops, sd_mode;
 
+	boot_trace_init();
     system_init(0);
 	boot_ops = get_boot_opt();
+	boot_trace(BOOT_TRACE_START, boot_ops);
 	if(!boot_ops) {
         // in secure boot, ignore boot opiton pin, go to check the image first
         if(!efuse_boot_debug_protect_enable()) {
@@ -614,11 +991,13 @@ int main( void )
 	// bit0: 0 - Flash; 1 - SD
 	// bit1: always try to boot from Flash
 	// bit2: always try to boot from SD card
-	// bit3: enable SDIO 4bit mode
+	// bit3: enable SDIO 4bit mode, high speed is tried in either width
 	boot_ops = efuse_boot_option();
+	boot_trace(BOOT_TRACE_OPTION, boot_ops);
+	sd_mode = SD_PROBE_HS | ((boot_ops & 0x08) ? SD_PROBE_4BIT : 0);
 
 	if((boot_ops & 0x01) == 0x01) {
-		if(!sd_card_probe(boot_ops & 0x08, NULL)) {
+		if(!sd_card_probe(sd_mode, NULL)) {
 			// boot from sd card
 			boot_sdcard();
 		}
@@ -639,7 +1018,7 @@ int main( void )
 
 		// if flash boot failed, try sd card
 		if((boot_ops & 0x04) == 0x04) {
-			if(!sd_card_probe(boot_ops & 0x08, NULL)) {
+			if(!sd_card_probe(sd_mode, NULL)) {
 				// boot from sd card
 				boot_sdcard();
 			}
@@ -683,10 +1062,11 @@ static void iomux_sel_sdc_dummy()
 }
 
 
-int sd_card_probe(int enable_4bit, void *config_io)
+int sd_card_probe(int bus_mode, void *config_io)
 {
     int ret;
 
+    boot_trace(BOOT_TRACE_SD_PROBE, bus_mode);
     if(NULL == config_io) {
         gm_api_sdc_platform_init((SDC_OPTION_ENABLE | SDC_OPTION_CD_INVERT), 0,
                 iomux_sel_sdc, (uint32_t) FTSDC021_SD_CARD_BUF);
@@ -698,19 +1078,39 @@ int sd_card_probe(int enable_4bit, void *config_io)
 // 	gm_sdc_api_action(SD_0, GM_SDC_ACTION_SET_ADMA_BUFER, FTSDC021_SD_ADMA_BUF, NULL);
 
  	ret = (int)gm_sdc_api_action(SD_0, GM_SDC_ACTION_CARD_DETECTION, NULL, NULL);
+ 	boot_trace(BOOT_TRACE_SD_DETECT, ret);
  	if (ret != 0) {
  		BOOT_LOG("%s (return %u): NO sdcard was found!! \r\n", __func__, ret);
  		return ret;
  	}
 
- 	if (enable_4bit) {
-//		IOMuxManager_PinConfigure (CSK_IOMUX_PAD_B, PIN_BOOT_SDIO_DAT2, IOMUX_PIN_BOOT_SDIO);  //sd_dat2
-//		IOMuxManager_PinConfigure (CSK_IOMUX_PAD_B, PIN_BOOT_SDIO_DAT3, IOMUX_PIN_BOOT_SDIO);  //sd_dat3
-
-		u32 bus_width = 4; // 1 for 1-bit SDIO, 4 for 4-bit SDIO
-		ret = gm_sdc_api_action(SD_0, GM_SDC_ACTION_SET_BUS_WIDTH, &bus_width, NULL);
-		BOOT_LOG("%s (return %u): set to 4 bit width!! \r\n", __func__, ret);
-    }
+ 	// card detection re-inits the host and clears the card info, so set it afterwards
+ 	gm_sdc_api_action(SD_0, GM_SDC_ACTION_SET_ADMA_BUFER, FTSDC021_SD_ADMA_BUF, NULL);
+
+//	IOMuxManager_PinConfigure (CSK_IOMUX_PAD_B, PIN_BOOT_SDIO_DAT2, IOMUX_PIN_BOOT_SDIO);  //sd_dat2
+//	IOMuxManager_PinConfigure (CSK_IOMUX_PAD_B, PIN_BOOT_SDIO_DAT3, IOMUX_PIN_BOOT_SDIO);  //sd_dat3
+
+ 	// falls back to 1 bit / default speed by itself if the card or the board can't keep up
+ 	sd_bus_mode = gm_sdc_api_negotiate_bus(SD_0,
+ 			(bus_mode & SD_PROBE_4BIT) ? 4 : 1,
+ 			(bus_mode & SD_PROBE_HS) ? 1 : 0,
+ 			SourceBuf);
+ 	BOOT_LOG("%s: %u bit width, speed %u \r\n", __func__, sd_bus_mode & 0xFF, sd_bus_mode >> 8);
+ 	boot_trace(BOOT_TRACE_SD_BUS, sd_bus_mode);
+
+ 	// a protective MBR means the partitions are described by the GPT
+ 	sd_gpt.valid = 0;
+ 	if(sd_read_blocks(0, 1, SourceBuf) == 0 && SourceBuf[0x1FE] == 0x55 && SourceBuf[0x1FF] == 0xAA) {
+ 		for(int i = 0; i < 4; i++) {
+ 			if(SourceBuf[PARTITION_TABLE_OFFSET + i * PARTITION_ENTRY_SIZE + 4] == GPT_MBR_TYPE) {
+ 				ret = gpt_scan(&sd_gpt, (uint8_t *)GPT_SCAN_BUF, GPT_SCAN_SECS, sd_read_blocks);
+ 				BOOT_LOG("%s: GPT scan %d \r\n", __func__, ret);
+ 				ret = 0;
+ 				break;
+ 			}
+ 		}
+ 	}
+ 	boot_trace(BOOT_TRACE_SD_PROBE_DONE, sd_gpt.valid);
 
  	return ret;
 }
@@ -10,6 +10,7 @@
 
 #include "stub_load.h"
 #include "log_print.h"
+#include "gpt.h"
 
 #define ROM_CODE_VERSION    0x05
 
@@ -44,12 +45,21 @@
 #define LOAD_BLK_SIZE       (1024 * 4)
 #define LOAD_BLK_NUM        16
 
-// size 8k - BUF_SIZE_ADJ
+// size 8k - BUF_SIZE_ADJ, SLIP frames are decoded in place
 #define SLIP_RX_BUF         (AP_RX_BUF_BASE)
-// size 4k + BUF_SIZE_ADJ
-#define DATA_RX_BUF         (SLIP_RX_BUF + MAX_WRITE_BLOCK)
+// size 8k - BUF_SIZE_ADJ, second rx buffer of the ESP_SYNC_CAP_WINDOW mode
+#define SLIP_RX_BUF2        (SLIP_RX_BUF + MAX_WRITE_BLOCK)
+// size 2 * BUF_SIZE_ADJ, response frames
+#define SLIP_TX_BUF         (SLIP_RX_BUF2 + MAX_WRITE_BLOCK)
+#define SLIP_TX_BUF_SIZE    (BUF_SIZE_ADJ * 2)
 // size 4k * n
 #define AP_SRAM_BASE        (AP_FREE_SRAM)
+// ESP_READ_FLASH ping-pong tx buffers, the flash_prog ring is idle while reading back
+#define READ_FLASH_TX_BUF       (AP_SRAM_BASE)
+#define READ_FLASH_TX_BUF_SIZE  (LOAD_BLK_SIZE * 2 + 4)
+// GPT entry array batches while probing the sd card, before any image or data is loaded
+#define GPT_SCAN_BUF            (AP_SRAM_BASE)
+#define GPT_SCAN_SECS           32
 
 
 enum threads
@@ -95,6 +105,14 @@ typedef struct {
 	uint16_t vec_cs;
 }img_header;
 
+// img_flags: the image after IMG_LZ4_HEAD is one LZ4 block, img_size is the stored
+// size and reserve[0] the unpacked one. ls_ota_header_t marks it with OTA_ZIP_MASK
+// and keeps the unpacked size in reserved[1]. Checksums and signatures cover the
+// image as stored, the head keeps headers, vectors and signature readable at vma.
+#define IMG_FLAG_LZ4            0x01
+#define IMG_LZ4_HEAD            1024
+#define OTA_ZIP_RAW_SIZE(hdr)   ((hdr)->reserved[1])
+
 typedef struct rom_funcs {
 	void (*patch_init)(void *param);
 }rom_funcs;
@@ -118,7 +136,8 @@ typedef enum {
 	PROCESS_EVENT_BUF_FREE,
 	PROCESS_EVENT_PROG_ERR,
 	PROCESS_EVENT_ERASE,
-	PROCESS_EVENT_PROG_OK
+	PROCESS_EVENT_PROG_OK,
+	PROCESS_EVENT_UART_TXD
 }PROCESS_EVENT_t;
 
 //typedef struct {
@@ -141,8 +160,18 @@ typedef struct {
 	uint8_t ctrl_head, ctrl_tail;
 //	uint16_t load_sz[LOAD_BLK_NUM];
 	data_ctrl_t data_ctrl[LOAD_BLK_NUM];
+	uint32_t erase_ahead;	// bytes erased ahead of the program front while idle, 0: off
+	uint8_t erasing;		// look-ahead erase 0: idle, 1: running, 2: stopped after an error
+	uint32_t erase_stall;	// ms programming waited for its erase
+	uint32_t prog_stall;	// ms reception waited for a free buffer
+	uint8_t incremental;	// compare with the flash content, erase/program only what differs
+	uint32_t skip_sect;		// sectors of the download already in flash
+	uint32_t erase_sect;	// sectors erased
+	uint32_t prog_sect;		// sectors programmed
 }flash_prog_t;
 
+#define FLASH_ERASE_AHEAD_DEF	(256 * 1024)
+
 typedef struct {
 	unsigned int flash_addr;
 	unsigned char *data;
@@ -179,11 +208,23 @@ extern void system_init(int stage);
 extern void flash_prog_init();
 extern int32_t flash_prog_in_process();
 extern int32_t flash_mem_cpy();
+extern int32_t flash_inflate();
+extern int32_t flash_inflate_pending();
+extern int32_t flash_end_resp(uint8_t *buf, uint8_t op, uint8_t error);
+extern int32_t read_flash_packet(uint8_t *out);
+extern int32_t read_flash_ack(const uint8_t *rx, uint32_t cnt);
+extern int32_t read_flash_rx_rearm();
+extern int32_t read_flash_digest(uint8_t *out);
 
 extern void sd_prog_init();
 extern int32_t sd_prog_in_process();
 extern int32_t sd_mem_cpy();
-int sd_card_probe(int enable_4bit, void *config_io);
+
+#define SD_PROBE_4BIT   0x01    // try 4 bit bus width
+#define SD_PROBE_HS     0x02    // try high speed (50MHz) timing
+extern uint32_t sd_bus_mode;
+extern gpt_t sd_gpt;
+int sd_card_probe(int bus_mode, void *config_io);
 
 //#ifdef ROM_DBG
 //extern void put_str(char *str);
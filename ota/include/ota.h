@@ -14,7 +14,7 @@
 #ifndef INCLUDE_OTA_OTA_H_
 #define INCLUDE_OTA_OTA_H_
 
-#if OTA_ZONE_USER_ADDRESS<OTA_ZONE_OTA_ADDRESS+OTA_ZONE_OTA_SIZE
+#if OTA_ZONE_RESUME_ADDRESS<OTA_ZONE_OTA_ADDRESS+OTA_ZONE_OTA_SIZE
 #error flash zone size overflow!
 #endif
 
@@ -34,10 +34,13 @@
 #define OTA_ZONE_ID_EXEC2       0x02
 #define OTA_ZONE_ID_EXEC3       0x03
 #define OTA_ZONE_ID_OTA         0xf0
+#define OTA_ZONE_ID_RESUME      0xf1
 #define OTA_ZONE_ID_USER        0xfe
 #define OTA_ZONE_ID_FACT        0xff
 
 #define OTA_BLOCK_SIZE      (0x1000)
+/// zones the ota module keeps a directory entry for
+#define OTA_MAX_ZONES       (16)
 
 /// ota status
 enum {
@@ -52,6 +55,7 @@ enum {
    OTA_DATA_ERROR       = 8,
    OTA_FLASH_ERROR      = 9,
    OTA_VERIFY_ERROR     = 10,
+   OTA_RESUME_CONFIRM   = 11,
 };
 
 /// ota command
@@ -67,6 +71,8 @@ enum {
     OTA_WRITE_DATA,
     /// new image verify information
     OTA_OTA_VERIFY,
+    /// query where an interrupted download continues
+    OTA_OTA_RESUME,
 
     /// update device name
     OTA_UPDATE_NAME = 20,
@@ -83,6 +89,8 @@ enum {
     OTA_HASH_MASK      = (1<<2),
     OTA_SIGN_MASK      = (1<<3),
     OTA_ENC_MASK       = (1<<4),
+    /// the data is a patch against the running image, see ota_delta.h
+    OTA_DELTA_MASK     = (1<<5),
 };
 
 /// ota mode
@@ -180,6 +188,14 @@ typedef struct {
     uint32_t checksum;
 } ls_ota_verify_cmd_t;
 
+/// OTA_OTA_RESUME command payload, filled in by the device
+typedef struct {
+    /// offset of the first block not written yet, the image size when all are
+    uint32_t address;
+    /// the same in OTA_BLOCK_SIZE blocks
+    uint32_t block;
+} ls_ota_resume_cmd_t;
+
 
 /// ota command header
 typedef struct {
@@ -197,6 +213,8 @@ typedef struct {
         ls_ota_data_t data;
         /// OTA_OTA_VERIFY command
         ls_ota_verify_cmd_t verify;
+        /// OTA_OTA_RESUME command
+        ls_ota_resume_cmd_t resume;
     };
 } ls_ota_cmd_t;
 
@@ -244,6 +262,8 @@ const ls_ota_ver_t *ota_get_current_version(uint8_t zone_id);
 
 /// check ota zone validation, crc32 check
 uint8_t ota_check_zone_crc(ls_ota_header_t *hdr);
+/// crc32 of the zone header alone, chain crc32() over the data after it
+uint32_t ota_zone_header_crc(const ls_ota_header_t *hdr);
 
 /// find flash zone by zone id
 ls_ota_header_t *ota_find_zone(uint8_t id);
@@ -257,5 +277,9 @@ uint8_t ota_process_command(ls_ota_cmd_t *cmd);
 /// check ota zone validation, checksum check
 uint8_t ota_check_sum(ls_ota_header_t *hdr);
 
+/// ota_check_sum() over an image that arrives in pieces, data holds len bytes from offset on,
+/// the word after the image is one more 4 byte piece at offset size
+uint32_t ota_check_sum_update(uint32_t checksum, uint32_t size, uint32_t offset, const uint8_t *data, uint32_t len);
+
 
 #endif /* INCLUDE_OTA_OTA_H_ */
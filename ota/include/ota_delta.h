@@ -0,0 +1,79 @@
+/**
+ ****************************************************************************************
+ *
+ * @file ota_delta.h
+ *
+ * @brief Streaming delta patch applier for OTA_DELTA_MASK updates.
+ *
+ * The patch rebuilds the new image from the image in the running zone. It is
+ * a sequence of commands, lengths are LEB128 varints and seeks are zigzag
+ * encoded signed varints:
+ *
+ *   0x00                    end of patch, the new image must be complete
+ *   0x01 <len> <seek>       move the source position by seek, copy len bytes
+ *   0x02 <len> <bytes>      len literal bytes
+ *   0x03 <len> <bytes>      len bytes of source plus byte, bsdiff style
+ *
+ * Copy and diff move the source position on by len. Commands may be split
+ * across packets at any byte. The new image is written in order through a
+ * page sized window, so the applier needs no RAM for the image itself.
+ *
+ * Copyright (C) ListenAI 2020-2099
+ *
+ *
+ ****************************************************************************************
+ */
+
+#ifndef INCLUDE_OTA_OTA_DELTA_H_
+#define INCLUDE_OTA_OTA_DELTA_H_
+
+#include <stdint.h>
+
+/// output window, one flash page
+#define OTA_DELTA_WINDOW    (256)
+
+/// patch commands
+enum {
+    OTA_DELTA_END   = 0x00,
+    OTA_DELTA_COPY  = 0x01,
+    OTA_DELTA_DATA  = 0x02,
+    OTA_DELTA_DIFF  = 0x03,
+};
+
+/// applier status
+enum {
+    OTA_DELTA_DONE       = 0,
+    OTA_DELTA_NEED_INPUT = 1,
+    OTA_DELTA_ERROR      = -1,
+};
+
+/// write len bytes of the new image at offset, returns 0 on success
+typedef int (*ota_delta_write_fn)(uint32_t offset, const uint8_t *data, uint32_t len);
+
+typedef struct {
+    /// image in the running zone
+    const uint8_t *src;
+    uint32_t src_size;
+    uint32_t src_pos;
+    /// new image, out_size bytes are expected
+    uint32_t out_size;
+    uint32_t out_pos;
+    ota_delta_write_fn write;
+    /// command being parsed
+    uint8_t  state;
+    uint8_t  op;
+    uint8_t  shift;
+    uint32_t val;
+    uint32_t len;
+    /// output not written to flash yet
+    uint32_t win_len;
+    uint8_t  win[OTA_DELTA_WINDOW];
+} ota_delta_t;
+
+/// start applying a patch against src
+void ota_delta_init(ota_delta_t *d, const uint8_t *src, uint32_t src_size, uint32_t out_size, ota_delta_write_fn write);
+
+/// consume a patch packet, returns OTA_DELTA_NEED_INPUT until the end command was applied
+int ota_delta_apply(ota_delta_t *d, const uint8_t *in, uint32_t len);
+
+#endif /* INCLUDE_OTA_OTA_DELTA_H_ */
@@ -11,12 +11,14 @@
  ****************************************************************************************
  */
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
 
 #include "chip.h"
 #include "cache.h"
 #include "ota.h"
+#include "ota_delta.h"
 #include "spiflash.h"
 #include "Driver_CRYPTO.h"
 
@@ -51,10 +53,61 @@ typedef struct {
     uint32_t    flash_base;
     /// crypto handler
     void *crypto_handler;
+    /// zone table index of the zone being written
+    uint8_t     zone_idx;
+    /// zone table index of the progress record zone, 0xff if there is none
+    uint8_t     progress_idx;
+    /// the progress record tracks the current download
+    uint8_t     progress_on;
+    /// bytes of the image written without a gap from its start
+    uint32_t    done;
+    /// patch bytes applied so far
+    uint32_t    patch_pos;
+    /// image offset of ota_write_buf[0]
+    uint32_t    buf_addr;
+    /// bytes in ota_write_buf not programmed yet, an encrypted download leaves a
+    /// full page here that is programmed while the next packet decrypts
+    uint32_t    buf_len;
 } ls_ota_env_t;
 
+/// zone directory entry, built by ota_initialize() so lookups need no flash reads
+typedef struct {
+    /// validated header, NULL if the zone holds no valid image
+    ls_ota_header_t *hdr;
+    /// version of the image in the zone
+    ls_ota_ver_t version;
+    /// the header was validated through the cipher region
+    uint8_t enc;
+} ls_ota_dir_t;
+
+
+/// download progress record, at the start of the OTA_ZONE_ID_RESUME zone
+typedef struct {
+    /// OTA_RESUME_MAGIC once the fields below are written, 0 once the image was verified
+    uint32_t magic;
+    /// image being downloaded
+    ls_ota_ver_t version;
+    /// target zone offset
+    uint32_t base;
+    /// image size
+    uint32_t size;
+    /// OTA_OTA_START flags
+    uint32_t flags;
+    /// one bit per OTA_BLOCK_SIZE block, programmed to 0 once the block is written
+    uint32_t bitmap[0];
+} ls_ota_progress_t;
+
+#define OTA_RESUME_MAGIC        0x4d535252  // "RRSM"
+/// packets are collected up to an image offset multiple of this before they are programmed,
+/// one flash page so the buffer costs no more RAM than a page program needs
+#define OTA_WRITE_BUF_SIZE      0x100
+#define OTA_PROGRESS_MAX_BLOCKS ((OTA_BLOCK_SIZE - sizeof(ls_ota_progress_t)) * 8)
+
 
 static ls_ota_env_t ota_env;
+static ls_ota_dir_t ota_dir[OTA_MAX_ZONES];
+static ota_delta_t ota_delta;
+static uint32_t ota_write_buf[OTA_WRITE_BUF_SIZE / 4];
 
 /* Unique initialisation vector */
 static const unsigned char ota_aes_cbc_iv[] = {
@@ -63,8 +116,30 @@ static const unsigned char ota_aes_cbc_iv[] = {
 
 
 extern uint32_t crc32(uint32_t val, const uint8_t *buf, size_t len);
+extern int32_t CRYPTO_AES_Decrypt_Start(void* res, const uint32_t * p_source, uint32_t num_bytes, uint32_t * p_dest);
+extern int32_t CRYPTO_AES_Wait(void* res);
 
 
+/// xor the ota_check_sum() words found in len bytes of the image from offset on: the
+/// word at k * 1KB for k = 1 .. size / 1KB, 32 at most. For a size that is a multiple
+/// of 1KB the last one is the word right after the image.
+uint32_t ota_check_sum_update(uint32_t checksum, uint32_t size, uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    uint32_t off, count;
+
+    count = size / 1024;
+    if(count > 32)
+        count = 32;
+
+    for(off = (offset + 1023) & ~1023; off + 4 <= offset + len; off += 1024)
+    {
+        if(off != 0 && off / 1024 <= count)
+            checksum ^= *(const uint32_t *)(data + off - offset);
+    }
+
+    return checksum;
+}
+
 uint8_t ota_check_sum(ls_ota_header_t *hdr)
 {
     if(hdr == NULL)
@@ -89,14 +164,9 @@ uint8_t ota_check_sum(ls_ota_header_t *hdr)
     return checksum==hdr->checksum;
 }
 
-uint8_t ota_check_zone_crc(ls_ota_header_t *hdr)
+/// crc32 of the header part of a zone, continue with the data after the header
+uint32_t ota_zone_header_crc(const ls_ota_header_t *hdr)
 {
-    uint32_t crc = 0;
-    uint32_t flags = -1;
-
-    if(hdr == NULL)
-        return 0;
-
     ls_ota_header_t hdr_orgin;
     hdr_orgin = *hdr;
     /// the crc is based on the flag 0xffffffff
@@ -109,7 +179,17 @@ uint8_t ota_check_zone_crc(ls_ota_header_t *hdr)
     hdr_orgin.flags &= ~(OTA_ENC_MASK);
 
     /// calculate header
-    crc = crc32(crc, (const uint8_t*)&hdr_orgin, sizeof(ls_ota_header_t));
+    return crc32(0, (const uint8_t*)&hdr_orgin, sizeof(ls_ota_header_t));
+}
+
+uint8_t ota_check_zone_crc(ls_ota_header_t *hdr)
+{
+    uint32_t crc;
+
+    if(hdr == NULL)
+        return 0;
+
+    crc = ota_zone_header_crc(hdr);
 
     /// calculate the image data crc
     crc = crc32(crc, (const uint8_t*)(hdr + 1), hdr->size - sizeof(ls_ota_header_t));
@@ -117,6 +197,29 @@ uint8_t ota_check_zone_crc(ls_ota_header_t *hdr)
     return crc==hdr->crc32;
 }
 
+/// refresh the directory entry of zone idx from its header on flash
+static void ota_dir_update(uint8_t idx)
+{
+    ls_ota_header_t *hdr;
+    ls_ota_dir_t *dir = &ota_dir[idx];
+    uint32_t address = ota_env.pConfig->zones[idx].address;
+
+    dir->hdr = NULL;
+    dir->enc = 0;
+
+    hdr = (ls_ota_header_t*)(CMN_FLASH_REGION+address);
+    if(!ota_check_sum(hdr))
+    {
+        hdr = (ls_ota_header_t*)(CP_CIPHER_REGION_A+address);
+        if(!ota_check_sum(hdr))
+            return;
+        dir->enc = 1;
+    }
+
+    dir->hdr = hdr;
+    dir->version = hdr->version;
+}
+
 uint8_t ota_initialize(FLASH_DEV *flash_dev)
 {
     uint32_t flash_base;
@@ -137,10 +240,27 @@ uint8_t ota_initialize(FLASH_DEV *flash_dev)
     ota_env.flash_dev = flash_dev;
     ota_env.pConfig = (ls_ota_config_t *)boot_loader->reserved[3]; //use reserved[3] to save ota config address
 
-    if(ota_env.pConfig != NULL)
-        return OTA_SUCCESS;
-    else
+    if(ota_env.pConfig == NULL)
         return OTA_INVALID_VERSION;
+
+    if(ota_env.pConfig->zone_count > OTA_MAX_ZONES)
+    {
+        ota_env.pConfig = NULL;
+        return OTA_INVALID_PARAM;
+    }
+
+    /// scan every zone header once, the ota commands keep the directory up to date
+    for(int i=0; i<ota_env.pConfig->zone_count; i++)
+    {
+        ota_dir_update(i);
+    }
+
+    ota_env.progress_on = 0;
+    ota_env.progress_idx = ota_find_zone_table(OTA_ZONE_ID_RESUME);
+    if(ota_env.progress_idx >= ota_env.pConfig->zone_count || ota_env.pConfig->zones[ota_env.progress_idx].size < OTA_BLOCK_SIZE)
+        ota_env.progress_idx = 0xff;
+
+    return OTA_SUCCESS;
 }
 
 uint8_t ota_uninitialize()
@@ -149,18 +269,20 @@ uint8_t ota_uninitialize()
     return OTA_SUCCESS;
 }
 
+static ls_ota_dir_t *ota_find_zone_dir(uint8_t id);
+
 /// get the image version with given zone_id
 const ls_ota_ver_t *ota_get_current_version(uint8_t zone_id)
 {
     if(ota_env.pConfig == NULL)
         return NULL;
 
-    ls_ota_header_t *zone = ota_find_zone(zone_id);
+    ls_ota_dir_t *dir = ota_find_zone_dir(zone_id);
 
-    if(zone == NULL)
+    if(dir == NULL)
         return NULL;
 
-    return &(zone->version);
+    return &(dir->version);
 }
 
 uint8_t ota_find_zone_table(uint8_t zone_id)
@@ -180,12 +302,11 @@ uint8_t ota_find_zone_table(uint8_t zone_id)
     return idx;
 }
 
-ls_ota_header_t *ota_find_zone(uint8_t id)
+/// newest valid image with the given id, read through the region its zone table entry asks for
+static ls_ota_dir_t *ota_find_zone_dir(uint8_t id)
 {
-    ls_ota_header_t *result = NULL;
-    ls_ota_header_t *hdr;
-    ls_ota_zone_t *zones = ota_env.pConfig->zones;
-    uint32_t flash_base;
+    ls_ota_dir_t *result = NULL;
+    ls_ota_dir_t *dir;
 
     if(ota_env.pConfig == NULL)
         return NULL;
@@ -194,28 +315,29 @@ ls_ota_header_t *ota_find_zone(uint8_t id)
     if(idx == 0xff)
         return NULL;
 
-    if(ota_env.pConfig->zones[idx].enc)
-        flash_base = CP_CIPHER_REGION_A;
-    else
-        flash_base = CMN_FLASH_REGION;
-
     for(int i=0; i<ota_env.pConfig->zone_count; i++)
     {
-        hdr = (ls_ota_header_t*)(flash_base+zones[i].address);
-        if(hdr->version.zone_id == id && ota_check_sum(hdr))
+        dir = &ota_dir[i];
+        if(dir->hdr != NULL && dir->version.zone_id == id && dir->enc == (ota_env.pConfig->zones[idx].enc != 0))
         {
-            if(result == NULL || hdr->version.version > result->version.version)
-                result = hdr;
+            if(result == NULL || dir->version.version > result->version.version)
+                result = dir;
         }
     }
 
     return result;
 }
 
+ls_ota_header_t *ota_find_zone(uint8_t id)
+{
+    ls_ota_dir_t *dir = ota_find_zone_dir(id);
+
+    return (dir != NULL) ? dir->hdr : NULL;
+}
+
 static uint8_t ota_find_blank_zone(uint32_t size)
 {
     uint8_t res = 0xff;
-    ls_ota_header_t *hdr, *hdr2;
     ls_ota_zone_t *zones = ota_env.pConfig->zones;
     int i,j;
 
@@ -225,12 +347,7 @@ static uint8_t ota_find_blank_zone(uint32_t size)
         {
             continue;
         }
-        hdr = (ls_ota_header_t*)(CMN_FLASH_REGION+zones[i].address);
-        if(!ota_check_sum(hdr))
-        {
-            hdr = (ls_ota_header_t*)(CP_CIPHER_REGION_A+zones[i].address);
-        }
-        if(!ota_check_sum(hdr))  // invalid execute zone
+        if(ota_dir[i].hdr == NULL)  // invalid execute zone
         {
             if(zones[i].size >= size)
             {
@@ -246,15 +363,9 @@ static uint8_t ota_find_blank_zone(uint32_t size)
         {
             for(j=i+1; j<ota_env.pConfig->zone_count; j++)
             {
-                hdr2 = (ls_ota_header_t*)(CMN_FLASH_REGION+zones[j].address);
-                if(!ota_check_sum(hdr2))
-                {
-                    hdr2 = (ls_ota_header_t*)(CP_CIPHER_REGION_A+zones[j].address);
-                }
-
-                if(ota_check_sum(hdr2) && hdr->version.zone_id == hdr2->version.zone_id)
+                if(ota_dir[j].hdr != NULL && ota_dir[i].version.zone_id == ota_dir[j].version.zone_id)
                 {
-                    if(hdr->version.version > hdr2->version.version)
+                    if(ota_dir[i].version.version > ota_dir[j].version.version)
                         res = j;
                     else
                         res = i;
@@ -311,6 +422,137 @@ static uint8_t ota_check_version(ls_ota_ver_t *new_ver)
     return result;
 }
 
+static const ls_ota_progress_t *ota_progress_record(void)
+{
+    return (const ls_ota_progress_t *)(CMN_FLASH_REGION + ota_env.pConfig->zones[ota_env.progress_idx].address);
+}
+
+/// program part of the progress record, bits only go from 1 to 0 and must not pass the cipher
+static int ota_progress_write(uint32_t offset, const void *data, uint32_t len)
+{
+    uint32_t enc = IP_SYSCTRL->REG_CIPHER_CTRL3.bit.CIPHER_EN_REGION_A;
+    int res;
+
+    IP_SYSCTRL->REG_CIPHER_CTRL3.bit.CIPHER_EN_REGION_A = 0;
+    flash_write_protection_set(ota_env.flash_dev, false);
+    res = flash_write(ota_env.flash_dev, ota_env.pConfig->zones[ota_env.progress_idx].address + offset, data, len);
+    flash_write_protection_set(ota_env.flash_dev, true);
+    IP_SYSCTRL->REG_CIPHER_CTRL3.bit.CIPHER_EN_REGION_A = enc;
+
+    return res;
+}
+
+/// bytes already written if the progress record belongs to this download, else 0
+static uint32_t ota_progress_resume(ls_ota_start_cmd_t *cmd)
+{
+    const ls_ota_progress_t *rec;
+    uint32_t blocks, i;
+
+    /// neither the AES-CBC chain nor the patch applier can be picked up in the middle
+    if(ota_env.progress_idx == 0xff || (cmd->flags & (OTA_ENC_MASK | OTA_DELTA_MASK)))
+        return 0;
+
+    HAL_InvalidateDCache();
+    rec = ota_progress_record();
+    if(rec->magic != OTA_RESUME_MAGIC || memcmp(&rec->version, &ota_env.new_ver, sizeof(ls_ota_ver_t)) ||
+            rec->base != ota_env.base || rec->size != cmd->size || rec->flags != cmd->flags)
+        return 0;
+
+    blocks = (cmd->size + OTA_BLOCK_SIZE - 1) / OTA_BLOCK_SIZE;
+    for(i=0; i<blocks; i++)
+    {
+        if(rec->bitmap[i / 32] & (1UL << (i % 32)))
+            break;
+    }
+
+    if(i == 0)
+        return 0;
+
+    /// a complete image that still has a record failed its verify, the caller
+    /// erases the record together with the zone
+    if(i == blocks && !ota_check_zone_crc((ls_ota_header_t *)(ota_env.flash_base + ota_env.base)))
+        return 0;
+
+    ota_env.progress_on = 1;
+    return (i < blocks) ? i * OTA_BLOCK_SIZE : cmd->size;
+}
+
+/// start a new progress record, the target zone must be erased already
+static void ota_progress_begin(ls_ota_start_cmd_t *cmd)
+{
+    ls_ota_progress_t rec;
+
+    if(ota_env.progress_idx == 0xff || (cmd->flags & (OTA_ENC_MASK | OTA_DELTA_MASK)) ||
+            (cmd->size + OTA_BLOCK_SIZE - 1) / OTA_BLOCK_SIZE > OTA_PROGRESS_MAX_BLOCKS)
+        return;
+
+    rec.version = ota_env.new_ver;
+    rec.base = ota_env.base;
+    rec.size = cmd->size;
+    rec.flags = cmd->flags;
+    /// the magic goes last, a record cut short by a power loss is never trusted
+    rec.magic = OTA_RESUME_MAGIC;
+    if(ota_progress_write(offsetof(ls_ota_progress_t, version), &rec.version, sizeof(rec) - sizeof(rec.magic)) == 0 &&
+            ota_progress_write(0, &rec.magic, sizeof(rec.magic)) == 0)
+        ota_env.progress_on = 1;
+}
+
+/// invalidate the progress record, the next start of the image erases the zone
+static void ota_progress_drop(void)
+{
+    uint32_t magic = 0;
+
+    if(!ota_env.progress_on)
+        return;
+
+    ota_progress_write(0, &magic, 4);
+    ota_env.progress_on = 0;
+}
+
+/// move the gapless written prefix on and record the blocks it completed
+static void ota_progress_mark(uint32_t address, uint32_t length)
+{
+    uint32_t from, to, word;
+
+    if(address > ota_env.done || address + length <= ota_env.done)
+        return;
+
+    from = ota_env.done / OTA_BLOCK_SIZE;
+    ota_env.done = address + length;
+    if(ota_env.done == ota_env.size)
+        to = (ota_env.done + OTA_BLOCK_SIZE - 1) / OTA_BLOCK_SIZE;
+    else
+        to = ota_env.done / OTA_BLOCK_SIZE;
+
+    if(!ota_env.progress_on)
+        return;
+
+    /// one program operation per bitmap word
+    while(from < to)
+    {
+        word = 0xffffffff;
+        do
+        {
+            word &= ~(1UL << (from % 32));
+            from++;
+        }while(from < to && (from % 32));
+
+        ota_progress_write(offsetof(ls_ota_progress_t, bitmap) + (from - 1) / 32 * 4, &word, 4);
+    }
+}
+
+/// program a piece of the image rebuilt by the patch applier
+static int ota_delta_write(uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    int res;
+
+    flash_write_protection_set(ota_env.flash_dev, false);
+    res = flash_write(ota_env.flash_dev, ota_env.base + offset, data, len);
+    flash_write_protection_set(ota_env.flash_dev, true);
+
+    return res;
+}
+
 static uint8_t ota_start_ota(ls_ota_start_cmd_t* cmd)
 {
     uint8_t result = OTA_SUCCESS;
@@ -356,7 +598,10 @@ static uint8_t ota_start_ota(ls_ota_start_cmd_t* cmd)
                 if(ota_env.pConfig->zones[i].id == OTA_ZONE_ID_OTA)
                 {
                     if(cmd->size <= ota_env.pConfig->zones[i].size)
+                    {
                         ota_env.base = ota_env.pConfig->zones[i].address;
+                        ota_env.zone_idx = i;
+                    }
                 }
             }
             if(ota_env.base == 0)
@@ -374,7 +619,10 @@ static uint8_t ota_start_ota(ls_ota_start_cmd_t* cmd)
                 break;
             }
             if(cmd->size <= ota_env.pConfig->zones[i].size)
+            {
                 ota_env.base = ota_env.pConfig->zones[i].address;
+                ota_env.zone_idx = i;
+            }
             else
             {
                 result = OTA_INVALID_PARAM;
@@ -386,6 +634,20 @@ static uint8_t ota_start_ota(ls_ota_start_cmd_t* cmd)
         ota_env.size = cmd->size;
         ota_env.crypto_handler = cmd->crypto_handler;
 
+        /// a patch rebuilds the image from the running one, it is not combined with the cipher
+        if(ota_env.new_flag & OTA_DELTA_MASK)
+        {
+            const ls_ota_header_t *src = ota_find_zone(zone_id);
+
+            if(src == NULL || (ota_env.new_flag & OTA_ENC_MASK))
+            {
+                result = OTA_INVALID_PARAM;
+                break;
+            }
+            ota_delta_init(&ota_delta, (const uint8_t *)src, src->size, cmd->size, ota_delta_write);
+            ota_env.patch_pos = 0;
+        }
+
         // prepare aes enc
         if(ota_env.new_flag & OTA_ENC_MASK)
         {
@@ -402,15 +664,32 @@ static uint8_t ota_start_ota(ls_ota_start_cmd_t* cmd)
         if(!ota_env.pConfig->zones[idx].enc)
             IP_SYSCTRL->REG_CIPHER_CTRL3.bit.CIPHER_EN_REGION_A = 0; // disable flash write encrypt
 
+        /// the zone holds no image from here on
+        ota_dir[ota_env.zone_idx].hdr = NULL;
+
+        /// an interrupted download of the same image continues without an erase
+        ota_env.progress_on = 0;
+        ota_env.done = ota_progress_resume(cmd);
+        ota_env.buf_addr = ota_env.done;
+        ota_env.buf_len = 0;
+        if(ota_env.done != 0)
+            break;
+
         flash_write_protection_set(ota_env.flash_dev, false);
 
-        /// earse flash
-        result = flash_erase(ota_env.flash_dev, ota_env.base, cmd->size);
+        /// drop the old progress record first, then earse flash
+        if(ota_env.progress_idx != 0xff)
+            result = flash_erase(ota_env.flash_dev, ota_env.pConfig->zones[ota_env.progress_idx].address, OTA_BLOCK_SIZE);
+        if(result == 0)
+            result = flash_erase(ota_env.flash_dev, ota_env.base, cmd->size);
         if(result != 0)
             result = OTA_FLASH_ERROR;
 
         flash_write_protection_set(ota_env.flash_dev, true);
 
+        if(result == OTA_SUCCESS)
+            ota_progress_begin(cmd);
+
     }while(0);
 
     if(result == OTA_SUCCESS)
@@ -424,6 +703,136 @@ static uint8_t ota_start_ota(ls_ota_start_cmd_t* cmd)
     return result;
 }
 
+/// apply a patch packet, the packets have to come in order
+static uint8_t ota_write_delta(ls_ota_data_t *cmd)
+{
+    if(cmd->address != ota_env.patch_pos)
+        return OTA_INVALID_PARAM;
+
+    /// the crc covers the patch data, the rebuilt image is checked by ota_check_data()
+    if(cmd->crc32 != 0 && crc32(0, cmd->data, cmd->length) != cmd->crc32)
+        return OTA_VERIFY_ERROR;
+
+    if(ota_delta_apply(&ota_delta, cmd->data, cmd->length) == OTA_DELTA_ERROR)
+        return OTA_DATA_ERROR;
+
+    ota_env.patch_pos += cmd->length;
+    return OTA_SUCCESS;
+}
+
+/// program one buffer of the image, the write protection is toggled once per buffer
+static uint8_t ota_write_program(uint32_t address, const uint32_t *buf, uint32_t len)
+{
+    int res;
+
+    flash_write_protection_set(ota_env.flash_dev, false);
+    res = flash_write(ota_env.flash_dev, ota_env.base + address, buf, len);
+    flash_write_protection_set(ota_env.flash_dev, true);
+
+    if(res != 0)
+        return OTA_FLASH_ERROR;
+
+    ota_progress_mark(address, len);
+    return OTA_SUCCESS;
+}
+
+/// program the collected packets
+static uint8_t ota_write_flush(void)
+{
+    uint8_t result;
+    uint32_t len = ota_env.buf_len;
+
+    if(len == 0)
+        return OTA_SUCCESS;
+
+    ota_env.buf_len = 0;
+    result = ota_write_program(ota_env.buf_addr, ota_write_buf, len);
+    if(result == OTA_SUCCESS)
+        ota_env.buf_addr += len;
+
+    return result;
+}
+
+/// program the buffer if it holds a finished page, a partial one keeps collecting
+static uint8_t ota_write_drain(void)
+{
+    uint32_t end = ota_env.buf_addr + ota_env.buf_len;
+
+    if(ota_env.buf_len == 0 || (end % OTA_WRITE_BUF_SIZE != 0 && end != ota_env.size))
+        return OTA_SUCCESS;
+
+    return ota_write_flush();
+}
+
+/// collect image data, a packet that doesn't continue the buffer flushes it first
+static uint8_t ota_write_buffered(uint32_t address, const uint8_t *data, uint32_t len)
+{
+    uint8_t result;
+    uint32_t end, n;
+
+    if(address != ota_env.buf_addr + ota_env.buf_len)
+    {
+        result = ota_write_flush();
+        if(result != OTA_SUCCESS)
+            return result;
+        ota_env.buf_addr = address;
+    }
+    else
+    {
+        /// the page left by the previous packet, if ota_write_decrypt() didn't take it
+        result = ota_write_drain();
+        if(result != OTA_SUCCESS)
+            return result;
+    }
+
+    while(len)
+    {
+        /// fill up to the next OTA_WRITE_BUF_SIZE boundary of the image
+        end = ota_env.buf_addr + ota_env.buf_len;
+        n = OTA_WRITE_BUF_SIZE - end % OTA_WRITE_BUF_SIZE;
+        if(n > len)
+            n = len;
+
+        memcpy((uint8_t *)ota_write_buf + ota_env.buf_len, data, n);
+        ota_env.buf_len += n;
+        data += n;
+        len -= n;
+
+        /// an encrypted packet leaves its last full page for the next decrypt to overlap
+        if(len == 0 && (ota_env.new_flag & OTA_ENC_MASK))
+            break;
+
+        if((end + n) % OTA_WRITE_BUF_SIZE == 0 || end + n == ota_env.size)
+        {
+            result = ota_write_flush();
+            if(result != OTA_SUCCESS)
+                return result;
+        }
+    }
+
+    return OTA_SUCCESS;
+}
+
+/// decrypt a packet in place, the page left in the buffer is programmed while the engine works
+static uint8_t ota_write_decrypt(uint8_t *data, uint32_t len)
+{
+    uint8_t result;
+    int32_t res = CSK_DRIVER_OK;
+
+    if(len != 0)
+        res = CRYPTO_AES_Decrypt_Start(ota_env.crypto_handler, (uint32_t*)data, len, (uint32_t*)data);
+
+    result = ota_write_drain();
+
+    if(len != 0 && res == CSK_DRIVER_OK)
+        res = CRYPTO_AES_Wait(ota_env.crypto_handler);
+
+    if(result != OTA_SUCCESS)
+        return result;
+
+    return (res == CSK_DRIVER_OK) ? OTA_SUCCESS : OTA_DATA_ERROR;
+}
+
 static uint8_t ota_write_data(ls_ota_data_t *cmd)
 {
     uint8_t result = OTA_SUCCESS;
@@ -438,6 +847,12 @@ static uint8_t ota_write_data(ls_ota_data_t *cmd)
             break;
         }
 
+        if(ota_env.new_flag & OTA_DELTA_MASK)
+        {
+            result = ota_write_delta(cmd);
+            break;
+        }
+
         if(cmd->address > ota_env.size)
         {
             result = OTA_INVALID_PARAM;
@@ -448,9 +863,11 @@ static uint8_t ota_write_data(ls_ota_data_t *cmd)
         if(ota_env.new_flag & OTA_ENC_MASK)
         {
             if(cmd->address == 0) // skip header
-                CRYPTO_AES_Decrypt(ota_env.crypto_handler, (uint32_t*)(cmd->data + sizeof(ls_ota_header_t)), cmd->length - sizeof(ls_ota_header_t), (uint32_t*)(cmd->data + sizeof(ls_ota_header_t)));
+                result = ota_write_decrypt(cmd->data + sizeof(ls_ota_header_t), cmd->length - sizeof(ls_ota_header_t));
             else
-                CRYPTO_AES_Decrypt(ota_env.crypto_handler, (uint32_t*)cmd->data, cmd->length, (uint32_t*)cmd->data);
+                result = ota_write_decrypt(cmd->data, cmd->length);
+            if(result != OTA_SUCCESS)
+                break;
         }
         // remove encrypt padding if needed
         if(cmd->address + cmd->length > ota_env.size)
@@ -458,20 +875,16 @@ static uint8_t ota_write_data(ls_ota_data_t *cmd)
             cmd->length = ota_env.size - cmd->address;
         }
 
-        flash_write_protection_set(ota_env.flash_dev, false);
-        /// write flash
-        result = flash_write(ota_env.flash_dev, ota_env.base + cmd->address, cmd->data, cmd->length);
-        if(result != 0)
-            result = OTA_FLASH_ERROR;
-
-        flash_write_protection_set(ota_env.flash_dev, true);
-
-        /// check sum
-        if(cmd->crc32 !=0 && crc32(0, (uint8_t *)ota_env.flash_base + ota_env.base + cmd->address, cmd->length)
-                  != cmd->crc32){
-        	result = OTA_VERIFY_ERROR;
+        /// check sum of the packet itself, ota_check_data() reads the programmed image back once
+        if(cmd->crc32 !=0 && crc32(0, cmd->data, cmd->length) != cmd->crc32)
+        {
+            result = OTA_VERIFY_ERROR;
+            break;
         }
 
+        /// write flash
+        result = ota_write_buffered(cmd->address, cmd->data, cmd->length);
+
     }while(0);
 
     if(result == OTA_SUCCESS)
@@ -493,6 +906,18 @@ static uint8_t ota_check_data(ls_ota_verify_cmd_t* cmd)
     if(ota_env.pConfig == NULL)
         return OTA_INVALID_PARAM;
 
+    /// the whole patch has to be applied
+    if((ota_env.new_flag & OTA_DELTA_MASK) && ota_delta_apply(&ota_delta, NULL, 0) != OTA_DELTA_DONE)
+        return OTA_VERIFY_ERROR;
+
+    /// program what is still collected
+    result = ota_write_flush();
+    if(result != OTA_SUCCESS)
+    {
+        ota_progress_drop();
+        return result;
+    }
+
     HAL_InvalidateDCache();
 
     if(ota_check_zone_crc((ls_ota_header_t *)(ota_env.flash_base + ota_env.base)))
@@ -502,6 +927,7 @@ static uint8_t ota_check_data(ls_ota_verify_cmd_t* cmd)
         {
             if(CSK_DRIVER_OK != CRYPTO_Verify_Flash_Signature(ota_env.crypto_handler, (uint8_t*)(ota_env.flash_base + ota_env.base), ota_env.pConfig->zones[idx].sign_mode))
             {
+                ota_progress_drop();
                 return OTA_VERIFY_ERROR;
             }
         }
@@ -522,12 +948,20 @@ static uint8_t ota_check_data(ls_ota_verify_cmd_t* cmd)
             result = OTA_VERIFY_CONFIRM;
 
         flash_write_protection_set(ota_env.flash_dev, true);
+
+        /// a switch mode image is bootable now, an overwrite mode one is only staged
+        HAL_InvalidateDCache();
+        ota_dir_update(ota_env.zone_idx);
     }
     else
     {
         result = OTA_VERIFY_ERROR;
     }
 
+    /// nothing is left to resume after a good image, resending a bad one over
+    /// its programmed bits can't fix it, so either way the next start erases
+    ota_progress_drop();
+
     // close aes
     if(ota_env.new_flag & OTA_ENC_MASK)
     {
@@ -539,6 +973,23 @@ static uint8_t ota_check_data(ls_ota_verify_cmd_t* cmd)
     return result;
 }
 
+static uint8_t ota_resume(ls_ota_resume_cmd_t* cmd)
+{
+    if(ota_env.state != OTA_DATA_WRITE || (ota_env.new_flag & OTA_DELTA_MASK))
+    {
+        return OTA_INVALID_CMD;
+    }
+
+    /// a partly written block is sent again, programming the same data twice is harmless
+    if(ota_env.done >= ota_env.size)
+        cmd->address = ota_env.size;
+    else
+        cmd->address = ota_env.done & ~(OTA_BLOCK_SIZE - 1);
+    cmd->block = (cmd->address + OTA_BLOCK_SIZE - 1) / OTA_BLOCK_SIZE;
+
+    return OTA_RESUME_CONFIRM;
+}
+
 uint8_t ota_process_command(ls_ota_cmd_t *cmd)
 {
     uint8_t result = OTA_SUCCESS;
@@ -561,6 +1012,9 @@ uint8_t ota_process_command(ls_ota_cmd_t *cmd)
         case OTA_OTA_VERIFY:
             result = ota_check_data((ls_ota_verify_cmd_t*)&(cmd->verify));
             break;
+        case OTA_OTA_RESUME:
+            result = ota_resume((ls_ota_resume_cmd_t*)&(cmd->resume));
+            break;
 
         default:
             result = OTA_INVALID_CMD;
@@ -0,0 +1,219 @@
+/**
+ ****************************************************************************************
+ *
+ * @file ota_delta.c
+ *
+ * @brief Streaming delta patch applier, see ota_delta.h.
+ *
+ * Copyright (C) ListenAI 2020-2099
+ *
+ *
+ ****************************************************************************************
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "ota_delta.h"
+
+/// parser state
+enum {
+    ST_OP = 0,
+    ST_LEN,
+    ST_SEEK,
+    ST_BYTES,
+    ST_DONE,
+    ST_BAD,
+};
+
+static int ota_delta_flush(ota_delta_t *d)
+{
+    if(d->win_len == 0)
+        return 0;
+
+    if(d->write(d->out_pos - d->win_len, d->win, d->win_len) != 0)
+        return -1;
+
+    d->win_len = 0;
+    return 0;
+}
+
+/// append n bytes of output, data is NULL for a copy, the bounds are checked by the caller
+static int ota_delta_emit(ota_delta_t *d, const uint8_t *data, uint32_t n)
+{
+    uint32_t i, k;
+    uint8_t *dst;
+    const uint8_t *src;
+
+    while(n)
+    {
+        k = OTA_DELTA_WINDOW - d->win_len;
+        if(k > n)
+            k = n;
+
+        dst = d->win + d->win_len;
+        src = d->src + d->src_pos;
+        if(d->op == OTA_DELTA_COPY)
+        {
+            memcpy(dst, src, k);
+        }
+        else if(d->op == OTA_DELTA_DATA)
+        {
+            memcpy(dst, data, k);
+        }
+        else
+        {
+            for(i=0; i<k; i++)
+                dst[i] = src[i] + data[i];
+        }
+
+        if(d->op != OTA_DELTA_DATA)
+            d->src_pos += k;
+        if(data != NULL)
+            data += k;
+        d->win_len += k;
+        d->out_pos += k;
+        n -= k;
+
+        if(d->win_len == OTA_DELTA_WINDOW && ota_delta_flush(d) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/// one byte of a varint, returns 1 once the value is complete, -1 if it is too long
+static int ota_delta_varint(ota_delta_t *d, uint8_t b)
+{
+    if(d->shift > 28 || (d->shift == 28 && (b & 0xf0)))
+        return -1;
+
+    d->val |= (uint32_t)(b & 0x7f) << d->shift;
+    d->shift += 7;
+
+    return (b & 0x80) ? 0 : 1;
+}
+
+void ota_delta_init(ota_delta_t *d, const uint8_t *src, uint32_t src_size, uint32_t out_size, ota_delta_write_fn write)
+{
+    memset(d, 0, sizeof(ota_delta_t));
+    d->src = src;
+    d->src_size = src_size;
+    d->out_size = out_size;
+    d->write = write;
+    d->state = ST_OP;
+}
+
+int ota_delta_apply(ota_delta_t *d, const uint8_t *in, uint32_t len)
+{
+    uint32_t n;
+    int32_t seek;
+    int res;
+
+    while(1)
+    {
+        switch(d->state)
+        {
+        case ST_OP:
+            if(len == 0)
+                return OTA_DELTA_NEED_INPUT;
+            d->op = *in++;
+            len--;
+            d->val = 0;
+            d->shift = 0;
+            if(d->op == OTA_DELTA_END)
+            {
+                if(d->out_pos != d->out_size || ota_delta_flush(d) != 0)
+                    d->state = ST_BAD;
+                else
+                    d->state = ST_DONE;
+            }
+            else if(d->op > OTA_DELTA_DIFF)
+            {
+                d->state = ST_BAD;
+            }
+            else
+            {
+                d->state = ST_LEN;
+            }
+            break;
+
+        case ST_LEN:
+            if(len == 0)
+                return OTA_DELTA_NEED_INPUT;
+            res = ota_delta_varint(d, *in++);
+            len--;
+            if(res == 0)
+                break;
+            d->len = d->val;
+            if(res < 0 || d->len > d->out_size - d->out_pos)
+            {
+                d->state = ST_BAD;
+                break;
+            }
+            if(d->op == OTA_DELTA_DIFF && d->len > d->src_size - d->src_pos)
+            {
+                d->state = ST_BAD;
+                break;
+            }
+            d->val = 0;
+            d->shift = 0;
+            d->state = (d->op == OTA_DELTA_COPY) ? ST_SEEK : ST_BYTES;
+            break;
+
+        case ST_SEEK:
+            if(len == 0)
+                return OTA_DELTA_NEED_INPUT;
+            res = ota_delta_varint(d, *in++);
+            len--;
+            if(res == 0)
+                break;
+            /// zigzag: 0, -1, 1, -2, ...
+            seek = (int32_t)(d->val >> 1) ^ -(int32_t)(d->val & 1);
+            if(res < 0 || (seek < 0 && (uint32_t)-seek > d->src_pos) ||
+                    (seek > 0 && (uint32_t)seek > d->src_size - d->src_pos))
+            {
+                d->state = ST_BAD;
+                break;
+            }
+            d->src_pos += seek;
+            if(d->len > d->src_size - d->src_pos || ota_delta_emit(d, NULL, d->len) != 0)
+            {
+                d->state = ST_BAD;
+                break;
+            }
+            d->state = ST_OP;
+            break;
+
+        case ST_BYTES:
+            if(d->len == 0)
+            {
+                d->state = ST_OP;
+                break;
+            }
+            if(len == 0)
+                return OTA_DELTA_NEED_INPUT;
+            n = (d->len > len) ? len : d->len;
+            if(ota_delta_emit(d, in, n) != 0)
+            {
+                d->state = ST_BAD;
+                break;
+            }
+            in += n;
+            len -= n;
+            d->len -= n;
+            break;
+
+        case ST_DONE:
+            /// nothing may follow the end command
+            if(len != 0)
+            {
+                d->state = ST_BAD;
+                break;
+            }
+            return OTA_DELTA_DONE;
+
+        default:
+            return OTA_DELTA_ERROR;
+        }
+    }
+}
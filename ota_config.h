@@ -48,4 +48,8 @@
 #define OTA_ZONE_USER_SIZE      0x4000
 #define OTA_ZONE_USER_ADDRESS   (OTA_ZONE_FACT_ADDRESS - OTA_ZONE_USER_SIZE)
 
+// partition OTA download progress, one sector, downloads restart from 0 without it
+#define OTA_ZONE_RESUME_SIZE    0x1000
+#define OTA_ZONE_RESUME_ADDRESS (OTA_ZONE_USER_ADDRESS - OTA_ZONE_RESUME_SIZE)
+
 
@@ -20,6 +20,14 @@ static uint32_t boot_sec_count = 0;
 static uint8_t  boot_enc_ready = 0;
 void* CRYPTO0_Handler;
 
+extern int32_t CRYPTO_Hash_Start(void* res, const uint32_t * p_source, uint32_t num_bytes, uint32_t update);
+extern int32_t CRYPTO_Hash_Wait(void* res);
+extern int32_t CRYPTO_Sign_Hash_Begin(void *pCrypto_Handler, const void *flash_zone, int sign_mode, uint32_t *offset);
+extern int32_t CRYPTO_Sign_Verify_Digest(void *pCrypto_Handler, const void *flash_zone, int sign_mode, uint32_t *digest);
+
+// a streamed hash buffer is still being read by the engine
+static uint8_t boot_hash_busy = 0;
+
 static volatile int32_t CRYPTO_Result = CSK_DRIVER_OK;
 static volatile uint32_t CRYPTO_DONE = 0;
 
@@ -54,13 +62,102 @@ int secure_init()
 // shutdown secure module
 int secure_shutdown()
 {
+    if(boot_hash_busy) {
+        CRYPTO_Hash_Wait(CRYPTO0_Handler);
+        boot_hash_busy = 0;
+    }
     boot_enc_ready = 0;
     CRYPTO_PowerControl(CRYPTO0_Handler, CSK_CRYPTO_HW_ECC_RSA, CSK_POWER_OFF);
     CRYPTO_Uninitialize(CRYPTO0_Handler);
+    CRYPTO0_Handler = NULL;
 
     return 1;
 }
 
+// sha256 of a flash region by the HSU engine, fed CRYPTO_MAX_PACKAGE_SIZE bytes per DMA transfer
+int secure_flash_sha256(const uint8_t *addr, uint32_t len, uint32_t *digest)
+{
+    int32_t res = CSK_DRIVER_OK;
+    uint32_t size, update = 0;
+
+    if(CRYPTO0_Handler == NULL) {
+        CRYPTO0_Handler = CRYPTO0();
+        CRYPTO_Initialize(CRYPTO0_Handler, CRYPTO_BOOT_EventCallback, NULL);
+    }
+    CRYPTO_PowerControl(CRYPTO0_Handler, CSK_CRYPTO_HW_AES_SHA, CSK_POWER_FULL);
+    CRYPTO_Control(CRYPTO0_Handler, CSK_CRYPTO_SET_HASH_MODE, CSK_CRYPTO_HASH_SHA256);
+
+    while(len && res == CSK_DRIVER_OK) {
+        size = (len > CRYPTO_MAX_PACKAGE_SIZE) ? CRYPTO_MAX_PACKAGE_SIZE : len;
+        // the digest is read out with the last package only
+        res = CRYPTO_Hash(CRYPTO0_Handler, (const uint32_t *)addr, size, (size == len) ? digest : NULL, update);
+        addr += size;
+        len -= size;
+        update = 1;
+    }
+
+    return res;
+}
+
+// streamed signature check of an image that is still being loaded, *offset
+// returns how many bytes of the zone are consumed here (header and sign area)
+int secure_verify_begin(const void *zone, int sign_mode, uint32_t *offset)
+{
+    boot_hash_busy = 0;
+    CRYPTO_PowerControl(CRYPTO0_Handler, CSK_CRYPTO_HW_AES_SHA, CSK_POWER_FULL);
+
+    return CRYPTO_Sign_Hash_Begin(CRYPTO0_Handler, zone, sign_mode, offset);
+}
+
+// hash the next len bytes (a multiple of 64), the engine is left working on
+// the last package so the caller can fetch the next chunk meanwhile
+int secure_verify_update(const uint8_t *data, uint32_t len)
+{
+    int32_t res = CSK_DRIVER_OK;
+    uint32_t size;
+
+    while(len) {
+        if(boot_hash_busy) {
+            boot_hash_busy = 0;
+            res = CRYPTO_Hash_Wait(CRYPTO0_Handler);
+            if(res != CSK_DRIVER_OK)
+                break;
+        }
+        size = (len > CRYPTO_MAX_PACKAGE_SIZE) ? CRYPTO_MAX_PACKAGE_SIZE : len;
+        CRYPTO_Hash_Start(CRYPTO0_Handler, (const uint32_t *)data, size, 1);
+        boot_hash_busy = 1;
+        data += size;
+        len -= size;
+    }
+
+    return res;
+}
+
+// hash the last len bytes of the zone and check the digest against the signature
+int secure_verify_end(const void *zone, int sign_mode, const uint8_t *data, uint32_t len)
+{
+    int32_t res = CSK_DRIVER_OK;
+    uint32_t digest[8];
+    uint32_t size;
+
+    if(boot_hash_busy) {
+        res = CRYPTO_Hash_Wait(CRYPTO0_Handler);
+        boot_hash_busy = 0;
+    }
+
+    while(len && res == CSK_DRIVER_OK) {
+        size = (len > CRYPTO_MAX_PACKAGE_SIZE) ? CRYPTO_MAX_PACKAGE_SIZE : len;
+        res = CRYPTO_Hash(CRYPTO0_Handler, (const uint32_t *)data, size, (size == len) ? digest : NULL, 1);
+        data += size;
+        len -= size;
+    }
+
+    if(res != CSK_DRIVER_OK)
+        return res;
+
+    return CRYPTO_Sign_Verify_Digest(CRYPTO0_Handler, zone, sign_mode, digest);
+}
+
 // get local public key
 int secure_get_local_public_key(uint32_t *buff)
 {
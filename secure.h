@@ -20,6 +20,12 @@ int secure_get_local_public_key(uint32_t *buff);
 int secure_set_peer_public_key(uint32_t *buff, uint8_t *checksum);
 // decrypt data
 int secure_decrypt_data(esp_command_req_t *cmd);
+// sha256 of a flash region by hardware
+int secure_flash_sha256(const uint8_t *addr, uint32_t len, uint32_t *digest);
+// streamed signature check, begin -> update per loaded chunk -> end with the last chunk
+int secure_verify_begin(const void *zone, int sign_mode, uint32_t *offset);
+int secure_verify_update(const uint8_t *data, uint32_t len);
+int secure_verify_end(const void *zone, int sign_mode, const uint8_t *data, uint32_t len);
 
 
 #endif /* TOOLS_UART_BURN_TOOL_CRYPTO_CRYPTO_H_ */
@@ -16,8 +16,18 @@
  */
 
 //#include "rom_functions.h"
+#include <string.h>
 #include "slip.h"
 
+#define SLIP_END        0xC0
+#define SLIP_ESC        0xDB
+#define SLIP_ESC_END    0xDC
+#define SLIP_ESC_ESC    0xDD
+
+/* non-zero if any byte of v is zero, see "Bit Twiddling Hacks" */
+#define SLIP_HAS_ZERO(v)    (((v) - 0x01010101UL) & ~(v) & 0x80808080UL)
+#define SLIP_HAS_SPECIAL(v) (SLIP_HAS_ZERO((v) ^ 0xC0C0C0C0UL) | SLIP_HAS_ZERO((v) ^ 0xDBDBDBDBUL))
+
 struct slip
 {
     char* tx_buf;
@@ -87,11 +97,7 @@ SLIP_send_frame_data(char ch)
 void
 SLIP_send_frame_data_buf(const void* buf, uint32_t size)
 {
-    int i;
-    const uint8_t* buf_c = (const uint8_t*)buf;
-    for (i = 0; i < size; i++) {
-        SLIP_send_frame_data(buf_c[i]);
-    }
+    s_slip.tx_idx += SLIP_encode_block(buf, size, (uint8_t*)s_slip.tx_buf + s_slip.tx_idx);
 }
 
 void
@@ -165,3 +171,114 @@ SLIP_recv(void* pkt, uint32_t max_len)
 
     return len;
 }
+
+/* length of the leading run without END/ESC bytes */
+static uint32_t
+SLIP_scan_plain(const uint8_t* p, uint32_t len)
+{
+    uint32_t i = 0, v;
+
+    while (i < len && ((uintptr_t)(p + i) & 0x3)) {
+        if (p[i] == SLIP_END || p[i] == SLIP_ESC) {
+            return i;
+        }
+        i++;
+    }
+    for (; i + 4 <= len; i += 4) {
+        memcpy(&v, p + i, 4);
+        if (SLIP_HAS_SPECIAL(v)) {
+            break;
+        }
+    }
+    for (; i < len; i++) {
+        if (p[i] == SLIP_END || p[i] == SLIP_ESC) {
+            break;
+        }
+    }
+    return i;
+}
+
+uint32_t
+SLIP_encode_block(const void* buf, uint32_t size, uint8_t* out)
+{
+    const uint8_t* in = (const uint8_t*)buf;
+    uint32_t i = 0, run, n = 0;
+
+    while (i < size) {
+        if (in[i] == SLIP_END || in[i] == SLIP_ESC) {
+            out[n++] = SLIP_ESC;
+            out[n++] = (in[i++] == SLIP_END) ? SLIP_ESC_END : SLIP_ESC_ESC;
+            continue;
+        }
+        run = SLIP_scan_plain(in + i, size - i);
+        memcpy(out + n, in + i, run);
+        n += run;
+        i += run;
+    }
+    return n;
+}
+
+int16_t
+SLIP_decode_block(const uint8_t* in, uint32_t len, uint32_t* consumed,
+                  uint8_t* out, uint32_t* out_len, uint32_t max_len, slip_state_t* state)
+{
+    uint32_t i = 0, run, o = *out_len;
+    int16_t ret = SLIP_NO_BYTE;
+    uint8_t ch;
+
+    while (i < len && o < max_len) {
+        if (*state == SLIP_NO_FRAME) {
+            /* skip anything up to the frame start */
+            while (i < len && in[i] != SLIP_END) {
+                i++;
+            }
+            if (i < len) {
+                i++;
+                *state = SLIP_FRAME;
+            }
+            continue;
+        }
+
+        if (*state == SLIP_FRAME_ESCAPING) {
+            ch = in[i++];
+            if (ch == SLIP_END) {
+                *state = SLIP_NO_FRAME;
+                ret = SLIP_FINISHED_FRAME;
+                break;
+            }
+            *state = SLIP_FRAME;
+            if (ch == SLIP_ESC_END) {
+                out[o++] = SLIP_END;
+            } else if (ch == SLIP_ESC_ESC) {
+                out[o++] = SLIP_ESC;
+            }
+            /* anything else is a framing error, drop it */
+            continue;
+        }
+
+        ch = in[i];
+        if (ch != SLIP_END && ch != SLIP_ESC) {
+            run = SLIP_scan_plain(in + i, len - i);
+            if (run > max_len - o) {
+                run = max_len - o;
+            }
+            if (out + o != in + i) {
+                memmove(out + o, in + i, run);
+            }
+            o += run;
+            i += run;
+            continue;
+        }
+        i++;
+        if (ch == SLIP_END) {
+            *state = SLIP_NO_FRAME;
+            ret = SLIP_FINISHED_FRAME;
+            break;
+        }
+        *state = SLIP_FRAME_ESCAPING;
+    }
+
+    *consumed = i;
+    *out_len = o;
+    return ret;
+}
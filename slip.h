@@ -63,4 +63,17 @@ SLIP_recv_byte(char byte, slip_state_t* state);
 uint32_t
 SLIP_recv(void* pkt, uint32_t max_len);
 
+/* Escape size bytes of frame data into out (no delimiters), returns the number
+   of bytes written, at most 2 * size. Escape-free runs are found 4 bytes at a time. */
+uint32_t
+SLIP_encode_block(const void* buf, uint32_t size, uint8_t* out);
+
+/* Decode len raw bytes, appending frame data at out + *out_len but not beyond max_len.
+   out may point into the input as long as it does not run ahead of it (in place decode).
+   *consumed returns the number of raw bytes used. Returns SLIP_FINISHED_FRAME right after
+   the frame end delimiter, SLIP_NO_BYTE when more input is needed or max_len is reached. */
+int16_t
+SLIP_decode_block(const uint8_t* in, uint32_t len, uint32_t* consumed,
+                  uint8_t* out, uint32_t* out_len, uint32_t max_len, slip_state_t* state);
+
 #endif /* SLIP_H_ */
@@ -13,9 +13,12 @@
 #include "ClockManager.h"
 #include "clock_config.h"
 #include "secure.h"
+#include "inflate.h"
+#include "boot_trace.h"
 
 extern flash_prog_t flash_prog;
 extern uint32_t cur_baud_rate, nxt_baud_rate;
+extern uint32_t esp_sync_caps;
 PROCESS_NAME(flash_prog_process);
 
 extern sd_prog_t sd_prog;
@@ -23,7 +26,6 @@ int32_t s_sd_block_start = 0;
 PROCESS_NAME(sd_prog_process);
 
 uart_buf_t ub;
-uart_buf_state_t ubs;
 
 int32_t *s_mem_cpy_dat;
 uint32_t s_mem_cpy_len;
@@ -37,27 +39,39 @@ int32_t s_mem_remaining = 0x01;
 //int32_t s_flash_offset = -1;
 int32_t s_mem_seq = 0;
 
-void
-ub_state_save()
-{
-    BOOT_LOG("ub_state_save, read=%d, state=%d\n", ub.read, ub.state);
-    ubs.read = ub.read;
-    ubs.state = ub.state;
-}
-
-void
-ub_state_recovery()
-{
-    ub.read = ubs.read;
-    ub.state = ubs.state;
-    BOOT_LOG("ub_state_recovery, read=%d, state=%d\n", ub.read, ub.state);
-}
+// the whole flash_prog ring is the inflate window, back references never reach the block being filled
+#define INFLATE_WIN_SIZE    ((LOAD_BLK_NUM - 1) * LOAD_BLK_SIZE)
+static inflate_t s_inflate;
+static inflate_status_t s_inflate_status = INFLATE_NEED_INPUT;
+
+#define READ_FLASH_MAX_PACKET   LOAD_BLK_SIZE
+#define READ_FLASH_MAX_INFLIGHT 64
+// acks are appended to the rx buffer, it is restarted once past this while the host is quiet
+#define READ_FLASH_RX_REARM     (MAX_WRITE_BLOCK / 2)
+
+typedef struct {
+    uint32_t offset;
+    uint32_t total;
+    uint32_t sent;
+    uint32_t acked;
+    uint32_t packet_size;
+    uint32_t max_inflight;
+    uint32_t rx_scan;   // raw bytes of the rx buffer already decoded
+    uint32_t ack_len;
+    slip_state_t ack_state;
+    uint32_t ack[2];
+    mbedtls_md5_context md5;
+} read_flash_t;
+static read_flash_t s_read_flash;
+
+static uint8_t s_pll_enabled = 0;
 
 void
 ub_state_init()
 {
-    ub.reading_buf = (uint8_t*)DATA_RX_BUF;
+    ub.reading_buf = (uint8_t*)SLIP_RX_BUF;
     ub.read = 0;
+    ub.scan = 0;
     ub.state = 0;
     ub.command = NULL;
     ub.error = 0;
@@ -73,6 +87,7 @@ pll_init(pll_clk_div_t *pll_clk_div)
 	// enable SYSPLL
 	IP_SYSNODEF->REG_SYSPLL_CFG0.bit.SYSPLL_ENABLE = 0x1;
 	while(!IP_SYSNODEF->REG_SYSPLL_CFG0.bit.SYSPLL_LOCK);
+	s_pll_enabled = 1;
 
 	// set core clk, default 300M
 	if(pll_clk_div->cpu_cfg_para != INVALID_PLL_VALUE) {
@@ -138,29 +153,39 @@ pll_init(pll_clk_div_t *pll_clk_div)
 esp_command_error
 uart_receive_bytes(uint8_t* bytes, int32_t len)
 {
-    int32_t i;
-    int16_t r = 0;
-    BOOT_LOG("uart_receive_bytes len is %d\n", len);
-    for (i = 0; i < len; i++) {
-        r = SLIP_recv_byte(bytes[i], (slip_state_t*)&ub.state);
-        //BOOT_LOG("uart_receive_bytes %d byte is %02x, r is %d\n", i, (uint8_t)bytes[i], r);
-        if (r >= 0) {
-            ub.reading_buf[ub.read++] = (uint8_t) r;
-            if (ub.read == MAX_WRITE_BLOCK) {
-                /* shouldn't happen unless there are data errors */
-                r = SLIP_FINISHED_FRAME;
-            }
-        }
-        if (r == SLIP_FINISHED_FRAME) {
-            /* end of frame, set 'command' */
-            ub.read = 0;
-            break;
-        }
+    uint32_t used = 0;
+    int16_t r;
+    BOOT_LOG("uart_receive_bytes len is %d, scan from %d\n", len, ub.scan);
+    /* bytes is the rx DMA buffer itself, only the part received since the last call
+       is decoded, and the decoded data never overtakes the raw data it comes from */
+    r = SLIP_decode_block(bytes + ub.scan, len - ub.scan, &used,
+                          ub.reading_buf, &ub.read, MAX_WRITE_BLOCK, &ub.state);
+    ub.scan += used;
+    if (ub.read == MAX_WRITE_BLOCK) {
+        /* shouldn't happen unless there are data errors */
+        r = SLIP_FINISHED_FRAME;
+    }
+    if (r == SLIP_FINISHED_FRAME) {
+        /* end of frame, set 'command' */
+        ub.read = 0;
+        ub.scan = 0;
     }
 
     return r == SLIP_FINISHED_FRAME ? ESP_OK : ESP_NOT_ENOUGH_DATA;
 }
 
+uint32_t
+handle_sync(uint32_t cap_word)
+{
+    if ((cap_word & ESP_SYNC_CAP_MAGIC_MASK) == ESP_SYNC_CAP_MAGIC) {
+        esp_sync_caps = cap_word & ESP_SYNC_CAP_SUPPORTED;
+    } else {
+        esp_sync_caps = 0;
+    }
+    BOOT_LOG("handle_sync caps 0x%x\n", esp_sync_caps);
+    return esp_sync_caps;
+}
+
 esp_command_error
 verify_data_len(esp_command_req_t* command, uint8_t len)
 {
@@ -277,11 +302,21 @@ int32_t sd_mem_cpy()
 esp_command_error
 handle_sd_begin(uint32_t size, uint32_t en_4bit, uint32_t config_io, uint32_t offset)
 {
-    if(sd_card_probe(en_4bit, (void *)config_io)) {
+    if(sd_card_probe((en_4bit ? SD_PROBE_4BIT : 0) | SD_PROBE_HS, (void *)config_io)) {
         BOOT_LOG("sd card probe failed\n");
         return ESP_ERR_SD_PROBE;
     }
 
+    if((offset & ESP_SD_PART_MAGIC_MASK) == ESP_SD_PART_MAGIC) {
+        const gpt_part_t *part = gpt_find(&sd_gpt, (gpt_part_id_t)(offset & 0xFF));
+
+        if(part == NULL || ((size + 511) >> 9) > part->last_lba - part->first_lba + 1) {
+            BOOT_LOG("sd partition %d not found or too small\n", offset & 0xFF);
+            return ESP_ERR_SD_PART;
+        }
+        offset = part->first_lba;
+    }
+
     sd_prog_init();
 
     s_sd_block_start = offset;
@@ -376,6 +411,14 @@ handle_flash_begin(uint32_t size, uint32_t offset)
     	flash_prog.data_ctrl[i].buf_idx = 0;
     	flash_prog.data_ctrl[i].size = 0;
     }
+    flash_prog.erasing = 0;
+    flash_prog.erase_stall = 0;
+    flash_prog.prog_stall = 0;
+    flash_prog.skip_sect = 0;
+    flash_prog.erase_sect = 0;
+    flash_prog.prog_sect = 0;
+    // start erasing ahead before the first block arrives
+    process_post(&flash_prog_process,  PROCESS_EVENT_BUF_RDY, (void *)-1);
 
     BOOT_LOG("handle_flash_begin data size is %d\n", size);
     return ESP_OK;
@@ -436,8 +479,8 @@ handle_flash_data(void* data, uint32_t seq_num, uint32_t length)
 
 int32_t flash_prog_in_process()
 {
-    // empty return 0, other return 1
-	return (flash_prog.ctrl_head == flash_prog.ctrl_tail ? 0 : 1);
+    // empty and no look-ahead erase running return 0, other return 1
+	return (flash_prog.ctrl_head == flash_prog.ctrl_tail && flash_prog.erasing != 1 ? 0 : 1);
 }
 
 int32_t flash_get_free_buf()
@@ -530,6 +573,222 @@ int32_t flash_mem_cpy()
 }
 
 
+esp_command_error
+handle_flash_deflated_begin(uint32_t size, uint32_t offset)
+{
+    // size is the uncompressed size, which is what ends up in flash
+    handle_flash_begin(size, offset);
+
+    inflate_init(&s_inflate, flash_prog.load_base, INFLATE_WIN_SIZE, INFLATE_FLAG_ZLIB_AUTO);
+    s_inflate_status = INFLATE_NEED_INPUT;
+
+    BOOT_LOG("handle_flash_deflated_begin data size is %d\n", size);
+    return ESP_OK;
+}
+
+esp_command_error
+handle_flash_deflated_data(void* data, uint32_t seq_num, uint32_t length)
+{
+    // length is compressed, overflow is detected by the inflater against s_mem_remaining
+    if (s_mem_offset == NULL && length > 0) {
+        return ESP_NOT_IN_FLASH_MODE;
+    }
+    if (seq_num == s_mem_seq) {
+        //get the same package again, it is fine, but do nothing
+    	s_mem_cpy_len = 0;
+        return ESP_OK;
+    }
+    if (seq_num != s_mem_seq + 1) {
+        return ESP_BAD_DATA_SEQ;
+    }
+    s_mem_seq = seq_num;
+
+    s_mem_cpy_dat = data;
+    s_mem_cpy_len = length;
+
+    return ESP_OK;
+}
+
+int32_t flash_inflate_pending()
+{
+	return (s_mem_cpy_len || s_inflate_status == INFLATE_NEED_OUTPUT);
+}
+
+// inflate the pending frame into the free buffer at ring tail
+// return -1: stream error, 0: no free buffer, 1: progress
+int32_t flash_inflate()
+{
+	int32_t idx = flash_get_free_buf();
+	data_ctrl_t *pbuf_cb;
+	uint32_t produced;
+
+	if(idx < 0) {
+		return 0;
+	}
+
+	pbuf_cb = &flash_prog.data_ctrl[idx];
+	s_inflate.in = (const uint8_t *)s_mem_cpy_dat;
+	s_inflate.in_len = s_mem_cpy_len;
+	s_inflate.out_avail = LOAD_BLK_SIZE - pbuf_cb->size;
+	if(s_inflate.out_avail > s_mem_remaining) {
+		s_inflate.out_avail = s_mem_remaining;
+	}
+
+	produced = s_inflate.total_out;
+	s_inflate_status = inflate_run(&s_inflate);
+	produced = s_inflate.total_out - produced;
+
+	s_mem_cpy_dat = (int32_t *)s_inflate.in;
+	s_mem_cpy_len = s_inflate.in_len;
+	s_mem_remaining -= produced;
+	pbuf_cb->size += produced;
+	if(produced && (s_mem_remaining == 0 || pbuf_cb->size == LOAD_BLK_SIZE)) {
+		BOOT_LOG("inf-%d-%d->\n", idx, pbuf_cb->buf_idx);
+
+		if(flash_prog_in_process() == 0) {
+			process_post(&flash_prog_process,  PROCESS_EVENT_BUF_RDY, (void *)idx);  // send event to flash program
+		}
+		flash_set_buf_rdy();
+	}
+
+	if(s_inflate_status == INFLATE_DONE) {
+		s_mem_cpy_len = 0;  // drop the zlib trailer
+	} else if(s_inflate_status == INFLATE_ERROR
+			|| (s_inflate_status == INFLATE_NEED_OUTPUT && s_mem_remaining == 0)) {
+		s_inflate_status = INFLATE_ERROR;
+		s_mem_cpy_len = 0;
+		return -1;
+	}
+
+	return 1;
+}
+
+esp_command_error
+handle_read_flash(uint32_t offset, uint32_t length, uint32_t packet_size, uint32_t max_inflight)
+{
+    read_flash_t *rf = &s_read_flash;
+
+    BOOT_LOG("handle_read_flash offset 0x%x, length %d, packet %d, inflight %d\n",
+            offset, length, packet_size, max_inflight);
+    // the tx buffers live in the load ring
+    if(flash_prog_in_process() || sd_prog_in_process()) {
+        return ESP_FAILED_SPI_OP;
+    }
+    if(packet_size == 0 || packet_size > READ_FLASH_MAX_PACKET) {
+        return ESP_BAD_BLOCKSIZE;
+    }
+    if(length == 0) {
+        return ESP_BAD_DATA_LEN;
+    }
+
+    memset(rf, 0, sizeof(read_flash_t));
+    rf->offset = offset;
+    rf->total = length;
+    rf->packet_size = packet_size;
+    rf->max_inflight = max_inflight ? max_inflight : 1;
+    if(rf->max_inflight > READ_FLASH_MAX_INFLIGHT) {
+        rf->max_inflight = READ_FLASH_MAX_INFLIGHT;
+    }
+    rf->ack_state = SLIP_NO_FRAME;
+    mbedtls_md5_init(&rf->md5);
+    mbedtls_md5_starts_ret(&rf->md5);
+
+    return ESP_OK;
+}
+
+// SLIP frame the next packet into out, return its size,
+// 0 if all is sent or max_inflight packets wait for their ack
+int32_t read_flash_packet(uint8_t *out)
+{
+    read_flash_t *rf = &s_read_flash;
+    const uint8_t *src;
+    uint32_t len, n;
+
+    if(rf->sent >= rf->total || rf->sent - rf->acked >= rf->max_inflight * rf->packet_size) {
+        return 0;
+    }
+    // let the host go quiet so that the rx buffer can be restarted
+    if(rf->rx_scan > READ_FLASH_RX_REARM) {
+        return 0;
+    }
+
+    len = rf->total - rf->sent;
+    if(len > rf->packet_size) {
+        len = rf->packet_size;
+    }
+    src = (const uint8_t *)(AP_FLASH_BASE + rf->offset + rf->sent);
+    mbedtls_md5_update_ret(&rf->md5, src, len);
+
+    n = 0;
+    out[n++] = 0xC0;
+    n += SLIP_encode_block(src, len, out + n);
+    out[n++] = 0xC0;
+    rf->sent += len;
+
+    return n;
+}
+
+// decode the acks received so far, each one is the number of bytes the host got
+// return 1: all acked, 0: progress, -1: nothing new
+int32_t read_flash_ack(const uint8_t *rx, uint32_t cnt)
+{
+    read_flash_t *rf = &s_read_flash;
+    uint32_t acked = rf->acked, used;
+    int16_t r;
+
+    while(rf->rx_scan < cnt) {
+        r = SLIP_decode_block(rx + rf->rx_scan, cnt - rf->rx_scan, &used,
+                (uint8_t *)rf->ack, &rf->ack_len, sizeof(rf->ack), &rf->ack_state);
+        rf->rx_scan += used;
+        if(r == SLIP_FINISHED_FRAME) {
+            if(rf->ack_len == 4 && rf->ack[0] > rf->acked && rf->ack[0] <= rf->sent) {
+                rf->acked = rf->ack[0];
+            }
+            rf->ack_len = 0;
+        } else if(rf->ack_len == sizeof(rf->ack)) {
+            // not an ack, drop the frame
+            rf->ack_len = 0;
+            rf->ack_state = SLIP_NO_FRAME;
+        }
+    }
+
+    if(rf->acked == rf->total) {
+        return 1;
+    }
+    return (rf->acked != acked) ? 0 : -1;
+}
+
+// return 1 if the rx buffer should be restarted, nothing is in flight then
+int32_t read_flash_rx_rearm()
+{
+    read_flash_t *rf = &s_read_flash;
+
+    if(rf->rx_scan <= READ_FLASH_RX_REARM || rf->sent != rf->acked) {
+        return 0;
+    }
+    rf->rx_scan = 0;
+    rf->ack_len = 0;
+    rf->ack_state = SLIP_NO_FRAME;
+    return 1;
+}
+
+// SLIP frame the md5 of everything sent into out, return its size
+int32_t read_flash_digest(uint8_t *out)
+{
+    read_flash_t *rf = &s_read_flash;
+    uint32_t digest[4];
+    uint32_t n = 0;
+
+    mbedtls_md5_finish_ret(&rf->md5, (uint8_t *)digest);
+    mbedtls_md5_free(&rf->md5);
+
+    out[n++] = 0xC0;
+    n += SLIP_encode_block(digest, sizeof(digest), out + n);
+    out[n++] = 0xC0;
+
+    return n;
+}
+
 // Among 32 bytes (8 uint32) of Data, theoretically 2 uint32 are used for MEM_END:
 // Execute Flag, Entry point Address
 // Actually none of them is used for MEM_END!
@@ -543,6 +802,57 @@ handle_mem_finish()
     return res;
 }
 
+// stall times of the last download for the FLASH_END response value,
+// ms waiting for erase in the low half, ms waiting for a free buffer in the high half
+uint32_t
+flash_stall_report()
+{
+    uint32_t erase_ms = flash_prog.erase_stall > 0xFFFF ? 0xFFFF : flash_prog.erase_stall;
+    uint32_t prog_ms = flash_prog.prog_stall > 0xFFFF ? 0xFFFF : flash_prog.prog_stall;
+
+    BOOT_LOG("flash stall: erase %d ms, buffer %d ms\n", flash_prog.erase_stall, flash_prog.prog_stall);
+    return erase_ms | (prog_ms << 16);
+}
+
+// sectors skipped, erased and programmed in the last download, appended to the FLASH_END response
+int32_t
+flash_sect_report(uint32_t *out)
+{
+    out[0] = flash_prog.skip_sect;
+    out[1] = flash_prog.erase_sect;
+    out[2] = flash_prog.prog_sect;
+    BOOT_LOG("flash sectors: skip %d, erase %d, program %d\n", out[0], out[1], out[2]);
+    return 12;
+}
+
+// FLASH_END response, built once flash_prog drained the ring so the report covers
+// the tail of the download, the error goes through the SLIP encoder as well since
+// the stall value ahead of it may hold bytes that get escaped
+int32_t
+flash_end_resp(uint8_t *buf, uint8_t op, uint8_t error)
+{
+    uint32_t data_ext[3];
+    int32_t bytes;
+    esp_command_response_t resp = {
+        .resp = 1,
+        .op_ret = op,
+        .len_ret = 2,
+        .value = flash_stall_report(),
+    };
+
+    bytes = flash_sect_report(data_ext);
+
+    SLIP_init((char*)buf, (char*)NULL);
+    SLIP_send_frame_delimiter();
+    SLIP_send_frame_data_buf(&resp, sizeof(esp_command_response_t));
+    SLIP_send_frame_data(error);
+    SLIP_send_frame_data(error == ESP_OK ? 0 : 1);
+    SLIP_send_frame_data_buf(data_ext, bytes);
+    SLIP_send_frame_delimiter();
+
+    return SLIP_get_tx_size();
+}
+
 esp_command_error
 handle_flash_finish()
 {
@@ -873,6 +1183,9 @@ do_cmd(uint8_t* buf, int32_t* len, comm_type comm)
             break;
         case ESP_SYNC:
             error = verify_data_len(command, 36);
+            if (error == ESP_OK) {
+                resp.value = handle_sync(data_words[8]);
+            }
             BOOT_LOG("ESP_SYNC error code is %d\n", error);
             break;
         case ESP_READ_VERSION:
@@ -895,9 +1208,29 @@ do_cmd(uint8_t* buf, int32_t* len, comm_type comm)
 			BOOT_LOG("ESP_FLASH_DATA error code is %d\n", error);
         	break;
         case ESP_FLASH_END:
+        	// the stall and sector report is built by flash_end_resp() once the ring drained
         	error = verify_data_len(command, 4) || handle_flash_finish();
         	BOOT_LOG("ESP_FLASH_END error code is %d\n", error);
         	break;
+        case ESP_FLASH_DEFLATED_BEGIN:
+        	error = verify_data_len(command, 16) || handle_flash_deflated_begin(data_words[0], data_words[3]);
+        	BOOT_LOG("ESP_FLASH_DEFLATED_BEGIN error code is %d\n", error);
+        	break;
+        case ESP_FLASH_DEFLATED_DATA:
+        	BOOT_LOG("ESP_FLASH_DEFLATED_DATA data_size=%d, seq_num=%d\n", data_words[0], data_words[1]);
+			cs = calculate_checksum(dbuf, dlen);
+			if (cs == (uint8_t)command->checksum) {
+				error = handle_flash_deflated_data(dbuf, data_words[1], dlen);
+			} else {
+				error = ESP_BAD_DATA_CHECKSUM;
+			}
+			BOOT_LOG("ESP_FLASH_DEFLATED_DATA error code is %d\n", error);
+        	break;
+        case ESP_FLASH_DEFLATED_END:
+        	// the stall and sector report is built by flash_end_resp() once the ring drained
+        	error = verify_data_len(command, 4) || handle_flash_finish();
+        	BOOT_LOG("ESP_FLASH_DEFLATED_END error code is %d\n", error);
+        	break;
         case ESP_FLASH_VERIFY_MD5:
         	error = mbedtls_md5_ret((uint8_t*)data_words[0] + AP_FLASH_BASE, data_words[1], data_ext);
 			if(error){
@@ -906,6 +1239,44 @@ do_cmd(uint8_t* buf, int32_t* len, comm_type comm)
 			bytes = 16;
 			BOOT_LOG("ESP_FLASH_VERIFY_MD5 error code is %d\n", error);
         	break;
+        case ESP_READ_FLASH:
+        	error = verify_data_len(command, 16) || handle_read_flash(data_words[0], data_words[1], data_words[2], data_words[3]);
+        	BOOT_LOG("ESP_READ_FLASH error code is %d\n", error);
+        	break;
+        case ESP_FLASH_VERIFY_SHA256:
+        {
+        	uint64_t cycles = __get_rv_cycle();
+        	if(data_words[1] == 0) {
+        		error = ESP_BAD_DATA_LEN;
+        	} else if(s_pll_enabled) {
+        		error = secure_flash_sha256((uint8_t*)data_words[0] + AP_FLASH_BASE, data_words[1], data_ext);
+        		resp.value = 1;
+        		bytes = 32;
+        	} else {
+        		error = mbedtls_md5_ret((uint8_t*)data_words[0] + AP_FLASH_BASE, data_words[1], data_ext);
+        		bytes = 16;
+        	}
+        	cycles = __get_rv_cycle() - cycles;
+        	if(error){
+        		error = ESP_IMG_UNKNOWN_ERROR;
+        		bytes = 0;
+        	} else {
+        		// the hash cycles follow the digest, the host times each path with them
+        		data_ext[bytes / 4] = (uint32_t)cycles;
+        		bytes += 4;
+        	}
+        	BOOT_LOG("ESP_FLASH_VERIFY_SHA256 error code is %d, %s %d bytes in %d cycles\n", error,
+        			resp.value ? "sha256" : "md5", data_words[1], (uint32_t)cycles);
+        	break;
+        }
+        case ESP_BOOT_TRACE:
+        	// a few records per response, the host repeats from data_ext[0] + records until it reaches resp value
+        	error = verify_data_len(command, 4);
+        	if(error == ESP_OK) {
+        		bytes = boot_trace_read(data_words[0], data_ext, sizeof(data_ext));
+        		resp.value = boot_trace_head();
+        	}
+        	break;
         case ESP_SET_BAUD:
         	if(data_words[1] != cur_baud_rate) {
         		error = ESP_INVALID_COMMAND;
@@ -955,6 +1326,8 @@ do_cmd(uint8_t* buf, int32_t* len, comm_type comm)
         	break;
         case ESP_SD_BEGIN:
             error = verify_data_len(command, 16) || handle_sd_begin(data_words[0], data_words[1], data_words[2], data_words[3]);
+            // report the negotiated bus width and speed
+            resp.value = sd_bus_mode;
             break;
         case ESP_SD_DATA:
             cs = calculate_checksum(dbuf, dlen);
@@ -971,6 +1344,12 @@ do_cmd(uint8_t* buf, int32_t* len, comm_type comm)
             extern FLASH_DEV flash_dev;
             flash_dev.addr_bytes = (command->data_buf[0] != 4) ? 3 : 4;
             flash_dev.dualflash_mode = (command->data_buf[1] != 0) ? true : false;
+            // 3rd byte: incremental download, only sectors that differ are erased/programmed
+            flash_prog.incremental = (command->data_len >= 3 && command->data_buf[2] != 0) ? 1 : 0;
+            // optional 2nd word: erase-ahead depth in bytes, 0 erases only when data is due
+            if(command->data_len >= 8) {
+                flash_prog.erase_ahead = data_words[1];
+            }
             error = flash_init(&flash_dev, 0, 0);
         default:
             is_valid_cmd = false;
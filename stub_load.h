@@ -53,6 +53,11 @@ typedef enum
     ENC_START  = 0x30,
     PLL_EN	= 0x31,
     FLASH_CONFIG = 0x32,
+    // resp value 1: 32 bytes sha256, 0: 16 bytes md5 as the HSU needs the PLL clocks,
+    // then 4 bytes with the cpu cycles the hash took
+    ESP_FLASH_VERIFY_SHA256 = 0x33,
+    // dump the boot trace ring from a sequence number on, resp value is the next sequence number
+    ESP_BOOT_TRACE = 0x34,
 
     ESP_SD_BEGIN = 0x40,
     ESP_SD_DATA = 0x41,
@@ -61,6 +66,19 @@ typedef enum
 } esp_command;
 
 
+/* ESP_SYNC capability negotiation: a host that knows about it replaces the last
+   word of the 0x55 sync pattern with ESP_SYNC_CAP_MAGIC | requested caps, the
+   granted caps are returned in the response value. A plain sync clears them. */
+#define ESP_SYNC_CAP_MAGIC      0xCA500000
+#define ESP_SYNC_CAP_MAGIC_MASK 0xFFFF0000
+#define ESP_SYNC_CAP_WINDOW     (1 << 0) /* data frames acked before programming, next frame received meanwhile */
+#define ESP_SYNC_CAP_SUPPORTED  (ESP_SYNC_CAP_WINDOW)
+
+/* ESP_SD_BEGIN offset naming a GPT partition (a gpt_part_id_t in the low byte)
+   instead of a raw sector, the data then lands at the start of that partition. */
+#define ESP_SD_PART_MAGIC       0x50415200
+#define ESP_SD_PART_MAGIC_MASK  0xFFFFFF00
+
 /* Command request header */
 typedef struct
 __attribute__((packed))
@@ -120,6 +138,7 @@ typedef enum
     ESP_BAD_DATA_READBACK = 0xCB,
     ESP_ERR_SD_PROBE = 0xCC,
     ESP_ERR_TIMEOUT = 0xCD,
+    ESP_ERR_SD_PART = 0xCE,
 
     ESP_IMG_HDR_MARK_ERROR = 0xF0,
     ESP_IMG_HDR_RSAKEY_OFFSET_ERROR = 0xF1,
@@ -160,26 +179,14 @@ typedef struct
 {
 //    uint8_t *buf_a;
     //uint8_t buf_b[MAX_WRITE_BLOCK+64];
-    uint8_t* reading_buf; /* Pointer to buf_a, or buf_b - which are we reading_buf? */
+    uint8_t* reading_buf; /* rx DMA buffer, frames are decoded in place */
     uint32_t read; /* how many bytes have we read in the frame */
+    uint32_t scan; /* how many raw bytes of the rx buffer have been decoded */
     slip_state_t state;
     esp_command_error error;
     esp_command_req_t* command; /* Pointer to buf_a or buf_b as latest command received */
 } uart_buf_t;
 
-typedef struct
-{
-    uint16_t read; /* how many bytes have we read in the frame */
-    slip_state_t state;
-} uart_buf_state_t;
-
-
-void
-ub_state_save();
-
-void
-ub_state_recovery();
-
 void
 ub_state_init();
 
@@ -0,0 +1,128 @@
+/*
+ * inflate_test.c
+ *
+ *  Host test of the streaming inflater against zlib's deflate. The stream is
+ *  fed in odd sized chunks and the output granted in slices the way
+ *  flash_inflate() does, the output is sized exactly to the image so the
+ *  end-of-block code has to be taken with no output space left.
+ *
+ *  make -C test && ./test/inflate_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "inflate.h"
+
+#define WIN_SIZE    (40 * 1024)
+#define IMG_MAX     (256 * 1024)
+
+static uint8_t img[IMG_MAX];
+static uint8_t out[IMG_MAX];
+static uint8_t zbuf[IMG_MAX + IMG_MAX / 8 + 64];
+static uint8_t win[WIN_SIZE];
+static inflate_t s_inflate;
+
+static void
+make_image(uint32_t size, int kind)
+{
+    uint32_t i;
+
+    for (i = 0; i < size; i++) {
+        if (kind == 0) {
+            img[i] = rand();                        /* stored blocks */
+        } else if (kind == 1) {
+            img[i] = "boot image text "[i & 15];    /* long matches */
+        } else {
+            img[i] = (rand() & 3) ? (uint8_t)(i >> 4) : rand();
+        }
+    }
+}
+
+/* same checks as flash_inflate(), returns 0 if the image came out complete */
+static int
+run_one(uint32_t size, int kind, int level, int strategy, int zlib_hdr)
+{
+    z_stream z;
+    uint32_t zlen, in_pos = 0, remaining = size, out_pos = 0, rd = 0;
+    uint32_t chunk, grant, n;
+    inflate_status_t st = INFLATE_NEED_INPUT;
+
+    make_image(size, kind);
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, level, Z_DEFLATED, zlib_hdr ? 15 : -15, 8, strategy) != Z_OK) {
+        return -1;
+    }
+    z.next_in = img;
+    z.avail_in = size;
+    z.next_out = zbuf;
+    z.avail_out = sizeof(zbuf);
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+        return -1;
+    }
+    zlen = z.total_out;
+    deflateEnd(&z);
+
+    inflate_init(&s_inflate, win, WIN_SIZE, INFLATE_FLAG_ZLIB_AUTO);
+    while (st != INFLATE_DONE) {
+        chunk = 1 + rand() % 1500;
+        if (chunk > zlen - in_pos) {
+            chunk = zlen - in_pos;
+        }
+        s_inflate.in = zbuf + in_pos;
+        s_inflate.in_len = chunk;
+        do {
+            grant = 1 + rand() % 4096;
+            if (grant > remaining) {
+                grant = remaining;
+            }
+            s_inflate.out_avail = grant;
+            n = s_inflate.total_out;
+            st = inflate_run(&s_inflate);
+            n = s_inflate.total_out - n;
+            remaining -= n;
+            /* copy out of the window before it gets reused */
+            while (n--) {
+                out[out_pos++] = win[rd];
+                rd = (rd + 1) % WIN_SIZE;
+            }
+            if (st == INFLATE_ERROR || (st == INFLATE_NEED_OUTPUT && remaining == 0)) {
+                printf("size %u kind %d level %d: st=%d rem=%u\n", size, kind, level, st, remaining);
+                return -1;
+            }
+        } while (st == INFLATE_NEED_OUTPUT);
+        in_pos += chunk - s_inflate.in_len;
+        if (st == INFLATE_NEED_INPUT && in_pos == zlen) {
+            printf("size %u kind %d level %d: stream cut short\n", size, kind, level);
+            return -1;
+        }
+    }
+
+    if (out_pos != size || memcmp(out, img, size)) {
+        printf("size %u kind %d level %d: output differs\n", size, kind, level);
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    static const int levels[] = {0, 1, 6, 9};
+    int i, fail = 0;
+
+    srand(1);
+    for (i = 0; i < 200; i++) {
+        uint32_t size = 1 + rand() % IMG_MAX;
+
+        fail |= run_one(size, i % 3, levels[i % 4], (i % 5 == 0) ? Z_FIXED : Z_DEFAULT_STRATEGY, i & 1);
+    }
+    /* an image that ends on a literal and one that ends on a match */
+    fail |= run_one(4096, 2, 6, Z_FIXED, 1);
+    fail |= run_one(4096, 1, 6, Z_DEFAULT_STRATEGY, 1);
+
+    printf("%s\n", fail ? "FAIL" : "ok");
+    return fail ? 1 : 0;
+}
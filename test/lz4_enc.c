@@ -0,0 +1,125 @@
+/*
+ * lz4_enc.c
+ *
+ *  Greedy LZ4 block compressor, one hash table slot per 4 byte sequence.
+ *  The block keeps the format's end rules, the last match starts at least
+ *  12 bytes and ends at least 5 bytes before the end, so any LZ4 decoder
+ *  takes it and it stays within LZ4_INPLACE_MARGIN() for in place decoding.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "lz4.h"
+#include "lz4_enc.h"
+
+#define HASH_BITS       16
+#define MAX_OFFSET      65535
+#define MF_LIMIT        12
+#define LAST_LITERALS   5
+
+typedef struct {
+    uint8_t *out;
+    uint32_t size;
+    uint32_t pos;
+    int err;
+} block_t;
+
+static void
+put_byte(block_t *b, uint8_t v)
+{
+    if (b->pos >= b->size) {
+        b->err = 1;
+        return;
+    }
+    b->out[b->pos++] = v;
+}
+
+/* the bytes of a length beyond the 15 that fit in the token */
+static void
+put_len(block_t *b, uint32_t n)
+{
+    for (; n >= 255; n -= 255) {
+        put_byte(b, 255);
+    }
+    put_byte(b, (uint8_t)n);
+}
+
+/* one sequence, mlen 0 for the final literal-only one */
+static void
+put_seq(block_t *b, const uint8_t *lit, uint32_t lit_len, uint32_t off, uint32_t mlen)
+{
+    uint32_t m = mlen ? mlen - LZ4_MIN_MATCH : 0;
+
+    put_byte(b, (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (m < 15 ? m : 15)));
+    if (lit_len >= 15) {
+        put_len(b, lit_len - 15);
+    }
+    if (b->pos + lit_len > b->size) {
+        b->err = 1;
+        return;
+    }
+    memcpy(b->out + b->pos, lit, lit_len);
+    b->pos += lit_len;
+
+    if (mlen) {
+        put_byte(b, (uint8_t)off);
+        put_byte(b, (uint8_t)(off >> 8));
+        if (m >= 15) {
+            put_len(b, m - 15);
+        }
+    }
+}
+
+static uint32_t
+hash(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+uint32_t
+lz4_encode(const uint8_t *src, uint32_t size, uint8_t *out, uint32_t out_size)
+{
+    block_t b = { out, out_size, 0, 0 };
+    uint32_t *table, i = 0, anchor = 0, cand, mlen, h;
+    uint32_t limit = size > MF_LIMIT ? size - MF_LIMIT : 0;
+
+    table = malloc(sizeof(uint32_t) << HASH_BITS);
+    if (table == NULL) {
+        return 0;
+    }
+    memset(table, 0xff, sizeof(uint32_t) << HASH_BITS);
+
+    while (i < limit) {
+        h = hash(src + i);
+        cand = table[h];
+        table[h] = i;
+
+        if (cand == 0xffffffff || i - cand > MAX_OFFSET || memcmp(src + cand, src + i, 4)) {
+            i++;
+            continue;
+        }
+
+        /* extend, the match has to end LAST_LITERALS before the end */
+        mlen = 4;
+        while (i + mlen < size - LAST_LITERALS && src[cand + mlen] == src[i + mlen]) {
+            mlen++;
+        }
+        /* and backwards into the pending literals */
+        while (i > anchor && cand > 0 && src[i - 1] == src[cand - 1]) {
+            i--;
+            cand--;
+            mlen++;
+        }
+
+        put_seq(&b, src + anchor, i - anchor, i - cand, mlen);
+        i += mlen;
+        anchor = i;
+    }
+    put_seq(&b, src + anchor, size - anchor, 0, 0);
+
+    free(table);
+    return b.err ? 0 : b.pos;
+}
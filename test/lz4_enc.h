@@ -0,0 +1,21 @@
+/*
+ * lz4_enc.h
+ *
+ *  Host side LZ4 block compressor for the decoder in lz4.c.
+ */
+
+#ifndef TEST_LZ4_ENC_H_
+#define TEST_LZ4_ENC_H_
+
+#include <stdint.h>
+
+/* worst case block size for n input bytes */
+#define LZ4_ENC_BOUND(n)    ((n) + (n) / 255 + 16)
+
+/*
+ * compress size bytes of src into one LZ4 block at out, returns the block
+ * size, or 0 if out_size is too small
+ */
+uint32_t lz4_encode(const uint8_t *src, uint32_t size, uint8_t *out, uint32_t out_size);
+
+#endif /* TEST_LZ4_ENC_H_ */
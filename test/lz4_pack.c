@@ -0,0 +1,184 @@
+/*
+ * lz4_pack.c
+ *
+ *  Pack a boot image for the LZ4 loaders in main.c:
+ *
+ *      lz4_pack [-o] <image> <packed image>
+ *
+ *  The first IMG_LZ4_HEAD bytes stay as they are, the rest becomes one LZ4
+ *  block. Without -o the image carries the img_header at IMG_HDR_POS: it
+ *  gets IMG_FLAG_LZ4, img_size becomes the stored size, reserve[0] the
+ *  unpacked size and both header sums are redone. With -o it starts with
+ *  an ls_ota_header_t: it gets OTA_ZIP_MASK, size becomes the stored size,
+ *  reserved[1] the unpacked size and checksum and crc32 are redone over the
+ *  image as stored. A signature can't be redone here, sign the packed image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "ota.h"
+#include "lz4_enc.h"
+
+/* as in main.c and main.h */
+#define IMG_HDR_POS         320
+#define HDR_SUM_POS         380
+#define VEC_SUM_POS         382
+#define IMG_SIZE_OFFSET     (IMG_HDR_POS + 4)
+#define IMG_FLAGS_OFFSET    (IMG_HDR_POS + 15)
+#define IMG_RAW_SIZE_OFFSET (IMG_HDR_POS + 32)
+#define IMG_FLAG_LZ4        0x01
+#define IMG_LZ4_HEAD        1024
+
+extern uint32_t crc32(uint32_t val, const uint8_t *buf, size_t len);
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/* header_verify() sums, returns -1 if the vector sum can't be met */
+static int
+img_header_sums(uint8_t *img)
+{
+    uint32_t i, sum = 0;
+
+    for (i = IMG_HDR_POS; i < HDR_SUM_POS; i++) {
+        sum += img[i];
+    }
+    img[HDR_SUM_POS] = (uint8_t)sum;
+    img[HDR_SUM_POS + 1] = (uint8_t)(sum >> 8);
+
+    sum &= 0xffff;
+    for (i = 0; i < IMG_HDR_POS; i++) {
+        sum = (sum + img[i]) & 0xffff;
+    }
+    sum += img[HDR_SUM_POS] + img[HDR_SUM_POS + 1];
+    if (sum > 0xffff) {
+        return -1;
+    }
+    img[VEC_SUM_POS] = (uint8_t)sum;
+    img[VEC_SUM_POS + 1] = (uint8_t)(sum >> 8);
+    return 0;
+}
+
+/* ota_check_sum() and ota_check_zone_crc() over the stored image */
+static void
+ota_header_sums(uint8_t *img, uint32_t size)
+{
+    ls_ota_header_t hdr;
+    uint32_t k, count, word, sum = 0, crc, n;
+
+    count = size / 1024;
+    if (count > 32) {
+        count = 32;
+    }
+    /* a word past the end of the image reads erased flash */
+    for (k = 1; k <= count; k++) {
+        word = 0xffffffff;
+        n = size - k * 1024;
+        if (k * 1024 < size) {
+            memcpy(&word, img + k * 1024, n < 4 ? n : 4);
+        }
+        sum ^= word;
+    }
+
+    memcpy(&hdr, img, sizeof(hdr));
+    hdr.checksum = sum;
+    memcpy(img, &hdr, sizeof(hdr));
+
+    hdr.valid_flag = 0xffffffff;
+    hdr.crc32 = 0;
+    hdr.flags &= ~OTA_ENC_MASK;
+    crc = crc32(0, (const uint8_t *)&hdr, sizeof(hdr));
+    crc = crc32(crc, img + sizeof(hdr), size - sizeof(hdr));
+    put32(img + offsetof(ls_ota_header_t, crc32), crc);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint8_t *raw, *packed;
+    uint32_t raw_size, size, cap, n;
+    ls_ota_header_t hdr;
+    int ota = 0;
+    long len;
+    FILE *f;
+
+    if (argc == 4 && !strcmp(argv[1], "-o")) {
+        ota = 1;
+        argv++;
+        argc--;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s [-o] <image> <packed image>\n", argv[0]);
+        return 2;
+    }
+
+    f = fopen(argv[1], "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)) {
+        fprintf(stderr, "can't read %s\n", argv[1]);
+        return 1;
+    }
+    raw_size = (uint32_t)len;
+    raw = malloc(raw_size + 1);
+    if (raw == NULL || fread(raw, 1, raw_size, f) != raw_size) {
+        fprintf(stderr, "can't read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    if (raw_size <= IMG_LZ4_HEAD) {
+        fprintf(stderr, "the image has to be larger than %u bytes\n", IMG_LZ4_HEAD);
+        return 1;
+    }
+    if (!ota && (raw[IMG_HDR_POS] != 'H' || raw[IMG_HDR_POS + 1] != 'r')) {
+        fprintf(stderr, "no image header at %u, -o for an ota header image\n", IMG_HDR_POS);
+        return 1;
+    }
+
+    cap = IMG_LZ4_HEAD + LZ4_ENC_BOUND(raw_size - IMG_LZ4_HEAD);
+    packed = malloc(cap);
+    if (packed == NULL) {
+        return 1;
+    }
+    memcpy(packed, raw, IMG_LZ4_HEAD);
+    n = lz4_encode(raw + IMG_LZ4_HEAD, raw_size - IMG_LZ4_HEAD, packed + IMG_LZ4_HEAD, cap - IMG_LZ4_HEAD);
+    if (n == 0) {
+        fprintf(stderr, "compression failed\n");
+        return 1;
+    }
+    size = IMG_LZ4_HEAD + n;
+
+    if (ota) {
+        memcpy(&hdr, packed, sizeof(hdr));
+        hdr.flags |= OTA_ZIP_MASK;
+        hdr.size = size;
+        hdr.reserved[1] = raw_size;
+        memcpy(packed, &hdr, sizeof(hdr));
+        ota_header_sums(packed, size);
+    } else {
+        packed[IMG_FLAGS_OFFSET] |= IMG_FLAG_LZ4;
+        put32(packed + IMG_SIZE_OFFSET, size);
+        put32(packed + IMG_RAW_SIZE_OFFSET, raw_size);
+        if (img_header_sums(packed)) {
+            fprintf(stderr, "the header sums can't be met, change a reserved byte\n");
+            return 1;
+        }
+    }
+
+    f = fopen(argv[2], "wb");
+    if (f == NULL || fwrite(packed, 1, size, f) != size || fclose(f) != 0) {
+        fprintf(stderr, "can't write %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("%u -> %u bytes\n", raw_size, size);
+    return 0;
+}
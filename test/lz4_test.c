@@ -0,0 +1,194 @@
+/*
+ * lz4_test.c
+ *
+ *  Host round trip of lz4_enc.c through the decoder in lz4.c. Blocks of
+ *  random, text like and repetitive data are decoded whole, in random
+ *  chunks and in place with the staging layout sd_load_image() uses.
+ *  Truncated blocks must not finish and a block that claims more output
+ *  than it was given room for must fail.
+ *
+ *  Then the decoder MB/s, whole and in 4KB chunks, per kind of data.
+ *
+ *  make -C test && ./test/lz4_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lz4.h"
+#include "lz4_enc.h"
+
+#define IMG_MAX     (512 * 1024)
+#define BENCH_SIZE  (4 * 1024 * 1024)
+
+static uint8_t img[IMG_MAX];
+static uint8_t blk[LZ4_ENC_BOUND(IMG_MAX)];
+static uint8_t out[IMG_MAX];
+/* output, in place margin and alignment slack */
+static uint8_t ram[IMG_MAX + LZ4_INPLACE_MARGIN(LZ4_ENC_BOUND(IMG_MAX)) + 64];
+
+static void
+make_image(uint8_t *p, uint32_t size, int kind)
+{
+    static const char *words[] = { "boot ", "image ", "flash ", "sector ", "0x1000 ", "lz4 " };
+    uint32_t i, k;
+
+    for (i = 0; i < size; i++) {
+        if (kind == 0) {
+            p[i] = rand();
+        } else if (kind == 1) {
+            const char *w = words[rand() % 6];
+            for (k = 0; w[k] && i < size; k++) {
+                p[i++] = w[k];
+            }
+            i--;
+        } else if (kind == 2) {
+            /* code like: repeats at short and long distances with noise */
+            p[i] = (rand() % 8) ? (i >= 64 ? p[i - 64 + rand() % 3] : (uint8_t)i) : rand();
+        } else {
+            p[i] = 0;
+        }
+    }
+}
+
+static lz4_status_t
+decode_chunks(uint8_t *dst, uint32_t size, const uint8_t *in, uint32_t len, uint32_t chunk)
+{
+    lz4_t s;
+    lz4_status_t st = LZ4_NEED_INPUT;
+    uint32_t pos = 0, n;
+
+    lz4_init(&s, dst, size);
+    while (pos < len && st == LZ4_NEED_INPUT) {
+        n = chunk ? chunk : 1 + rand() % 3000;
+        if (n > len - pos) {
+            n = len - pos;
+        }
+        s.in = in + pos;
+        s.in_len = n;
+        st = lz4_run(&s);
+        pos += n;
+    }
+    if (len == 0) {
+        st = lz4_run(&s);
+    }
+    return (st == LZ4_DONE && s.total_out != size) ? LZ4_ERROR : st;
+}
+
+/* the block is staged at the end of the output the way sd_load_image() does it */
+static int
+decode_in_place(uint32_t size, uint32_t len)
+{
+    uintptr_t base = ((uintptr_t)ram + 31) & ~(uintptr_t)31;
+    uint8_t *dst = (uint8_t *)base;
+    uint8_t *stage;
+
+    stage = (uint8_t *)(((uintptr_t)dst + size + LZ4_INPLACE_MARGIN(len) - len + 31) & ~(uintptr_t)31);
+    if (stage < dst) {
+        stage = dst;
+    }
+    memcpy(stage, blk, len);
+
+    return decode_chunks(dst, size, stage, len, 0) == LZ4_DONE && !memcmp(dst, img, size) ? 0 : -1;
+}
+
+static int
+run_one(uint32_t size, int kind)
+{
+    uint32_t len;
+
+    make_image(img, size, kind);
+    len = lz4_encode(img, size, blk, sizeof(blk));
+    if (len == 0) {
+        printf("size %u kind %d: encoding failed\n", size, kind);
+        return -1;
+    }
+
+    if (decode_chunks(out, size, blk, len, len) != LZ4_DONE || memcmp(out, img, size)) {
+        printf("size %u kind %d: whole block differs\n", size, kind);
+        return -1;
+    }
+    if (decode_chunks(out, size, blk, len, 0) != LZ4_DONE || memcmp(out, img, size)) {
+        printf("size %u kind %d: chunked block differs\n", size, kind);
+        return -1;
+    }
+    if (decode_in_place(size, len)) {
+        printf("size %u kind %d: in place decode differs\n", size, kind);
+        return -1;
+    }
+    if (size && decode_chunks(out, size, blk, rand() % len, 0) == LZ4_DONE) {
+        printf("size %u kind %d: truncated block finished\n", size, kind);
+        return -1;
+    }
+    if (size > 1 && decode_chunks(out, size - 1, blk, len, 0) != LZ4_ERROR) {
+        printf("size %u kind %d: output overrun not caught\n", size, kind);
+        return -1;
+    }
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench(const char *name, int kind)
+{
+    static uint8_t src[BENCH_SIZE], dst[BENCH_SIZE], enc[LZ4_ENC_BOUND(BENCH_SIZE)];
+    double t, whole, chunked, mb = BENCH_SIZE / 1e6;
+    uint32_t len;
+    int i, ok;
+
+    make_image(src, BENCH_SIZE, kind);
+    len = lz4_encode(src, BENCH_SIZE, enc, sizeof(enc));
+
+    /* best of a few runs, the first one also faults the output in */
+    ok = 1;
+    for (whole = chunked = 1e9, i = 0; i < 5; i++) {
+        t = now();
+        ok &= decode_chunks(dst, BENCH_SIZE, enc, len, len) == LZ4_DONE;
+        t = now() - t;
+        whole = t < whole ? t : whole;
+
+        t = now();
+        ok &= decode_chunks(dst, BENCH_SIZE, enc, len, 4096) == LZ4_DONE;
+        t = now() - t;
+        chunked = t < chunked ? t : chunked;
+    }
+    printf("%-8s ratio %5.3f  whole %7.1f MB/s  4KB chunks %7.1f MB/s\n",
+           name, (double)len / BENCH_SIZE, mb / whole, mb / chunked);
+
+    if (!ok || memcmp(dst, src, BENCH_SIZE)) {
+        printf("%-8s round trip differs\n", name);
+    }
+}
+
+int
+main(void)
+{
+    int i, fail = 0;
+
+    srand(1);
+    for (i = 0; i < 400 && !fail; i++) {
+        fail |= run_one(rand() % ((i & 7) ? 20000 : IMG_MAX), i % 4);
+    }
+    for (i = 0; i < 40 && !fail; i++) {
+        fail |= run_one(i, i % 4);
+    }
+    printf("%s\n", fail ? "FAIL" : "ok");
+    if (fail) {
+        return 1;
+    }
+
+    bench("random", 0);
+    bench("text", 1);
+    bench("code", 2);
+    bench("zero", 3);
+    return 0;
+}
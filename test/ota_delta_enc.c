@@ -0,0 +1,164 @@
+/*
+ * ota_delta_enc.c
+ *
+ *  Greedy patch generator for ota_delta_apply(). Source positions are
+ *  hashed by their next MATCH_MIN bytes, new data that continues the
+ *  source in place or matches a hashed position becomes a copy, the bytes
+ *  in between become a diff against the source where most of them agree
+ *  and literal data otherwise. Good enough to produce test and field
+ *  patches, not tuned for size.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ota_delta.h"
+#include "ota_delta_enc.h"
+
+#define MATCH_MIN   16
+#define HASH_BITS   16
+
+typedef struct {
+    uint8_t *out;
+    uint32_t size;
+    uint32_t pos;
+    int err;
+} patch_t;
+
+static void
+put_byte(patch_t *p, uint8_t b)
+{
+    if (p->pos >= p->size) {
+        p->err = 1;
+        return;
+    }
+    p->out[p->pos++] = b;
+}
+
+static void
+put_varint(patch_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        put_byte(p, (uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    put_byte(p, (uint8_t)v);
+}
+
+static uint32_t
+hash(const uint8_t *p)
+{
+    uint32_t h = 0, i;
+
+    for (i = 0; i < MATCH_MIN; i++) {
+        h = h * 31 + p[i];
+    }
+    return (h * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint32_t
+match_len(const uint8_t *a, const uint8_t *b, uint32_t max)
+{
+    uint32_t n = 0;
+
+    while (n < max && a[n] == b[n]) {
+        n++;
+    }
+    return n;
+}
+
+/* emit the n bytes at dst, the source position moves on for a diff only */
+static void
+put_literal(patch_t *p, const uint8_t *src, uint32_t src_size, uint32_t *src_pos,
+            const uint8_t *dst, uint32_t n)
+{
+    uint32_t i, same = 0;
+
+    if (n == 0) {
+        return;
+    }
+
+    if (src_size - *src_pos >= n) {
+        for (i = 0; i < n; i++) {
+            same += (src[*src_pos + i] == dst[i]);
+        }
+    }
+
+    if (same * 2 > n) {
+        put_byte(p, OTA_DELTA_DIFF);
+        put_varint(p, n);
+        for (i = 0; i < n; i++) {
+            put_byte(p, (uint8_t)(dst[i] - src[*src_pos + i]));
+        }
+        *src_pos += n;
+    } else {
+        put_byte(p, OTA_DELTA_DATA);
+        put_varint(p, n);
+        for (i = 0; i < n; i++) {
+            put_byte(p, dst[i]);
+        }
+    }
+}
+
+uint32_t
+ota_delta_encode(const uint8_t *src, uint32_t src_size,
+                 const uint8_t *dst, uint32_t dst_size,
+                 uint8_t *out, uint32_t out_size)
+{
+    patch_t p = { out, out_size, 0, 0 };
+    uint32_t *table, i, lit = 0, src_pos = 0, cand, n, best, best_pos;
+    int32_t seek;
+
+    table = malloc(sizeof(uint32_t) << HASH_BITS);
+    if (table == NULL) {
+        return 0;
+    }
+    memset(table, 0xff, sizeof(uint32_t) << HASH_BITS);
+    for (i = 0; i + MATCH_MIN <= src_size; i++) {
+        table[hash(src + i)] = i;
+    }
+
+    i = 0;
+    while (i < dst_size) {
+        best = 0;
+        best_pos = 0;
+
+        /* the source going on in place is preferred, its seek is 0 */
+        if (src_pos < src_size) {
+            best = match_len(src + src_pos, dst + i, dst_size - i < src_size - src_pos
+                             ? dst_size - i : src_size - src_pos);
+            best_pos = src_pos;
+        }
+        if (best < MATCH_MIN && i + MATCH_MIN <= dst_size) {
+            cand = table[hash(dst + i)];
+            if (cand != 0xffffffff) {
+                n = match_len(src + cand, dst + i, dst_size - i < src_size - cand
+                              ? dst_size - i : src_size - cand);
+                if (n > best) {
+                    best = n;
+                    best_pos = cand;
+                }
+            }
+        }
+
+        if (best < MATCH_MIN) {
+            lit++;
+            i++;
+            continue;
+        }
+
+        put_literal(&p, src, src_size, &src_pos, dst + i - lit, lit);
+        lit = 0;
+
+        seek = (int32_t)(best_pos - src_pos);
+        put_byte(&p, OTA_DELTA_COPY);
+        put_varint(&p, best);
+        put_varint(&p, ((uint32_t)seek << 1) ^ (uint32_t)(seek >> 31));
+        src_pos = best_pos + best;
+        i += best;
+    }
+    put_literal(&p, src, src_size, &src_pos, dst + i - lit, lit);
+    put_byte(&p, OTA_DELTA_END);
+
+    free(table);
+    return p.err ? 0 : p.pos;
+}
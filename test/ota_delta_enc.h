@@ -0,0 +1,20 @@
+/*
+ * ota_delta_enc.h
+ *
+ *  Host side patch generator for the format in ota/include/ota_delta.h.
+ */
+
+#ifndef TEST_OTA_DELTA_ENC_H_
+#define TEST_OTA_DELTA_ENC_H_
+
+#include <stdint.h>
+
+/*
+ * write a patch that rebuilds dst from src into out, returns its size, or 0
+ * if out_size is too small. The worst case is a little over dst_size.
+ */
+uint32_t ota_delta_encode(const uint8_t *src, uint32_t src_size,
+                          const uint8_t *dst, uint32_t dst_size,
+                          uint8_t *out, uint32_t out_size);
+
+#endif /* TEST_OTA_DELTA_ENC_H_ */
@@ -0,0 +1,74 @@
+/*
+ * ota_delta_gen.c
+ *
+ *  Build an OTA_DELTA_MASK patch on the host:
+ *
+ *      ota_delta_gen <running image> <new image> <patch>
+ *
+ *  Both images are the zone images as flashed, header included, the patch
+ *  is sent as the OTA_WRITE_DATA payload of a download whose size is the
+ *  new image size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ota_delta_enc.h"
+
+static uint8_t *
+load(const char *name, uint32_t *size)
+{
+    FILE *f = fopen(name, "rb");
+    uint8_t *buf = NULL;
+    long n;
+
+    if (f == NULL) {
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+        buf = malloc(n ? n : 1);
+        if (buf != NULL && fread(buf, 1, n, f) != (size_t)n) {
+            free(buf);
+            buf = NULL;
+        }
+        *size = (uint32_t)n;
+    }
+    fclose(f);
+    return buf;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint8_t *src, *dst, *patch;
+    uint32_t src_size, dst_size, cap, n;
+    FILE *f;
+
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <running image> <new image> <patch>\n", argv[0]);
+        return 2;
+    }
+
+    src = load(argv[1], &src_size);
+    dst = load(argv[2], &dst_size);
+    if (src == NULL || dst == NULL) {
+        fprintf(stderr, "can't read the images\n");
+        return 1;
+    }
+
+    cap = dst_size + dst_size / 8 + 64;
+    patch = malloc(cap);
+    n = patch ? ota_delta_encode(src, src_size, dst, dst_size, patch, cap) : 0;
+    if (n == 0) {
+        fprintf(stderr, "encoding failed\n");
+        return 1;
+    }
+
+    f = fopen(argv[3], "wb");
+    if (f == NULL || fwrite(patch, 1, n, f) != n || fclose(f) != 0) {
+        fprintf(stderr, "can't write %s\n", argv[3]);
+        return 1;
+    }
+
+    printf("%u -> %u bytes, patch %u bytes\n", src_size, dst_size, n);
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * ota_delta_test.c
+ *
+ *  Host test of ota/ota_delta.c with patches from ota_delta_enc.c. New
+ *  images are made from a random source by edits, inserts, deletes and
+ *  moved blocks. Each patch is applied in random sized packets, down to
+ *  single bytes, and has to rebuild the image exactly. Truncated patches
+ *  must never report done, and patches for a different size, with bytes
+ *  after the end command or with a seek out of the source must fail.
+ *
+ *  make -C test && ./test/ota_delta_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ota_delta.h"
+#include "ota_delta_enc.h"
+
+#define IMG_MAX     (128 * 1024)
+#define PATCH_MAX   (IMG_MAX + IMG_MAX / 8 + 64)
+
+static uint8_t src[IMG_MAX];
+static uint8_t dst[IMG_MAX];
+static uint8_t out[IMG_MAX];
+static uint8_t patch[PATCH_MAX];
+static ota_delta_t s_delta;
+static uint32_t out_next;
+static int write_err;
+
+/* the applier has to write the image in order and inside the declared size */
+static int
+write_out(uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    if (offset != out_next || len > OTA_DELTA_WINDOW || offset + len > IMG_MAX) {
+        write_err = 1;
+        return -1;
+    }
+    memcpy(out + offset, data, len);
+    out_next += len;
+    return 0;
+}
+
+static uint32_t
+make_new(uint32_t src_size)
+{
+    uint32_t size = 0, pos = 0, n, k;
+
+    while (pos < src_size && size < IMG_MAX - 1024) {
+        n = 1 + rand() % 2048;
+        if (n > src_size - pos) {
+            n = src_size - pos;
+        }
+        if (n > IMG_MAX - 1024 - size) {
+            n = IMG_MAX - 1024 - size;
+        }
+
+        switch (rand() % 6) {
+        case 0:         /* inserted data */
+            for (k = 0; k < n / 4; k++) {
+                dst[size++] = rand();
+            }
+            break;
+        case 1:         /* deleted data */
+            pos += n;
+            break;
+        case 2:         /* a few bytes patched, e.g. relocated addresses */
+            memcpy(dst + size, src + pos, n);
+            for (k = 0; k < n; k += 1 + rand() % 64) {
+                dst[size + k] += rand();
+            }
+            size += n;
+            pos += n;
+            break;
+        case 3:         /* a block from elsewhere in the source */
+            k = rand() % src_size;
+            if (n > src_size - k) {
+                n = src_size - k;
+            }
+            memcpy(dst + size, src + k, n);
+            size += n;
+            break;
+        default:        /* unchanged */
+            memcpy(dst + size, src + pos, n);
+            size += n;
+            pos += n;
+            break;
+        }
+    }
+    return size;
+}
+
+/* feed len bytes of patch in random packets, returns the last status */
+static int
+apply(uint32_t out_size, const uint8_t *p, uint32_t len, uint32_t src_size, int small)
+{
+    uint32_t pos = 0, n;
+    int st = OTA_DELTA_NEED_INPUT;
+
+    ota_delta_init(&s_delta, src, src_size, out_size, write_out);
+    out_next = 0;
+    write_err = 0;
+
+    while (pos < len && st == OTA_DELTA_NEED_INPUT) {
+        n = small ? 1 + rand() % 8 : 1 + rand() % 1500;
+        if (n > len - pos) {
+            n = len - pos;
+        }
+        st = ota_delta_apply(&s_delta, p + pos, n);
+        pos += n;
+    }
+    /* ota_check_data() asks once more with no input */
+    if (st != OTA_DELTA_ERROR) {
+        st = ota_delta_apply(&s_delta, NULL, 0);
+    }
+    return write_err ? OTA_DELTA_ERROR : st;
+}
+
+static int
+run_one(int n)
+{
+    uint32_t src_size, dst_size, len, cut;
+    int st;
+
+    src_size = 1 + rand() % IMG_MAX;
+    for (cut = 0; cut < src_size; cut++) {
+        src[cut] = (n & 1) ? rand() : (uint8_t)(cut >> 5);
+    }
+    dst_size = make_new(src_size);
+
+    len = ota_delta_encode(src, src_size, dst, dst_size, patch, PATCH_MAX);
+    if (len == 0) {
+        printf("%d: encoding failed\n", n);
+        return -1;
+    }
+
+    /* whole patch, split anywhere */
+    st = apply(dst_size, patch, len, src_size, n % 4 == 0);
+    if (st != OTA_DELTA_DONE || out_next != dst_size || memcmp(out, dst, dst_size)) {
+        printf("%d: %u -> %u, patch %u: st %d out %u\n", n, src_size, dst_size, len, st, out_next);
+        return -1;
+    }
+
+    /* truncated, at a random point and just before the end command */
+    cut = rand() % len;
+    if (apply(dst_size, patch, cut, src_size, 0) == OTA_DELTA_DONE ||
+        apply(dst_size, patch, len - 1, src_size, 0) == OTA_DELTA_DONE) {
+        printf("%d: truncated patch accepted\n", n);
+        return -1;
+    }
+
+    /* the image declared shorter or longer than the patch builds */
+    if ((dst_size && apply(dst_size - 1, patch, len, src_size, 0) != OTA_DELTA_ERROR) ||
+        apply(dst_size + 1, patch, len, src_size, 0) != OTA_DELTA_ERROR) {
+        printf("%d: wrong image size accepted\n", n);
+        return -1;
+    }
+
+    /* bytes after the end command */
+    patch[len] = OTA_DELTA_END;
+    if (apply(dst_size, patch, len + 1, src_size, 0) != OTA_DELTA_ERROR) {
+        printf("%d: data after the end accepted\n", n);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* hand made patches against the bounds of the source */
+static int
+run_bounds(void)
+{
+    static const uint8_t seek_back[] = { OTA_DELTA_COPY, 4, 3, OTA_DELTA_END };   /* seek -2 */
+    static const uint8_t seek_past[] = { OTA_DELTA_COPY, 4, 2, OTA_DELTA_END };   /* seek 1, 4 left */
+    static const uint8_t diff_past[] = { OTA_DELTA_DIFF, 5, 0, 0, 0, 0, 0, OTA_DELTA_END };
+    static const uint8_t bad_op[] = { 0x04, OTA_DELTA_END };
+    static const uint8_t long_len[] = { OTA_DELTA_DATA, 0xff, 0xff, 0xff, 0xff, 0x7f };
+    static const uint8_t ok[] = { OTA_DELTA_COPY, 4, 0, OTA_DELTA_END };
+
+    memset(src, 0x11, 4);
+    if (apply(4, seek_back, sizeof(seek_back), 4, 0) != OTA_DELTA_ERROR ||
+        apply(4, seek_past, sizeof(seek_past), 4, 0) != OTA_DELTA_ERROR ||
+        apply(5, diff_past, sizeof(diff_past), 4, 0) != OTA_DELTA_ERROR ||
+        apply(4, bad_op, sizeof(bad_op), 4, 0) != OTA_DELTA_ERROR ||
+        apply(4, long_len, sizeof(long_len), 4, 0) != OTA_DELTA_ERROR ||
+        apply(4, ok, sizeof(ok), 4, 0) != OTA_DELTA_DONE) {
+        printf("source bounds not checked\n");
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    int i, fail = 0;
+
+    srand(1);
+    for (i = 0; i < 300 && !fail; i++) {
+        fail |= run_one(i);
+    }
+    fail |= run_bounds();
+
+    printf("%s\n", fail ? "FAIL" : "ok");
+    return fail ? 1 : 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * ota_write_test.c
+ *
+ *  Host test of the OTA_WRITE_DATA path in ota/ota.c. Images are sent in
+ *  random sized packets with random resends and gaps, plain and encrypted,
+ *  into a NOR flash model that can only clear bits. The flash has to match
+ *  the image and every program has to stay inside one flash page.
+ *
+ *  make -C test && ./test/ota_write_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ota_config.h"
+#include "../ota/ota.c"
+
+#define ZONE_BASE   0x10000
+#define IMG_MAX     (256 * 1024)
+#define PKT_MAX     (8 * 1024)
+
+sysctrl_t *IP_SYSCTRL = &(sysctrl_t){0};
+
+static uint8_t flash[ZONE_BASE + IMG_MAX + 0x1000];
+static uint8_t img[IMG_MAX];
+static uint8_t pkt[PKT_MAX];
+static int write_err;
+
+/// the packet being decrypted, programming it before CRYPTO_AES_Wait() is an error
+static const uint8_t *aes_buf;
+static uint32_t aes_len;
+
+void HAL_InvalidateDCache(void) {}
+
+int flash_write_protection_set(FLASH_DEV *dev, bool enable)
+{
+    return 0;
+}
+
+int flash_erase(FLASH_DEV *dev, off_t offset, size_t size)
+{
+    memset(flash + offset, 0xff, size);
+    return 0;
+}
+
+int flash_write(FLASH_DEV *dev, off_t offset, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t i;
+
+    if (offset < ZONE_BASE || offset + len > sizeof(flash))
+        write_err |= 1;
+    if (len == 0 || offset / 0x100 != (offset + len - 1) / 0x100)
+        write_err |= 2;
+    if (aes_len && p < aes_buf + aes_len && p + len > aes_buf)
+        write_err |= 4;
+
+    for (i = 0; i < len; i++)
+        flash[offset + i] &= p[i];
+    return 0;
+}
+
+int32_t CRYPTO_PowerControl(void *handler, int32_t hw, int32_t state)
+{
+    return CSK_DRIVER_OK;
+}
+
+int32_t CRYPTO_Control(void *handler, uint32_t control, uint32_t arg)
+{
+    return CSK_DRIVER_OK;
+}
+
+int32_t CRYPTO_Verify_Flash_Signature(void *handler, const void *hdr, int32_t mode)
+{
+    return CSK_DRIVER_OK;
+}
+
+/// xor stands in for the cipher, the result is only valid after the wait
+int32_t CRYPTO_AES_Decrypt_Start(void *handler, const uint32_t *src, uint32_t len, uint32_t *dst)
+{
+    uint32_t i;
+
+    if (len % 16)
+        return -1;
+    for (i = 0; i < len; i++)
+        ((uint8_t *)dst)[i] = ((const uint8_t *)src)[i] ^ 0x5a;
+    aes_buf = (const uint8_t *)dst;
+    aes_len = len;
+    return CSK_DRIVER_OK;
+}
+
+int32_t CRYPTO_AES_Wait(void *handler)
+{
+    aes_len = 0;
+    return CSK_DRIVER_OK;
+}
+
+static int
+send(uint32_t addr, uint32_t len, uint32_t size, int enc)
+{
+    ls_ota_data_t cmd = { .address = addr, .length = len, .data = pkt };
+    uint32_t i, o;
+
+    for (i = 0; i < len; i++) {
+        o = addr + i;
+        pkt[i] = o < size ? img[o] : 0;
+    }
+    cmd.crc32 = crc32(0, pkt, addr + len > size ? size - addr : len);
+
+    if (enc) {
+        for (i = 0; i < len; i++)
+            if (addr + i >= sizeof(ls_ota_header_t))
+                pkt[i] ^= 0x5a;
+    }
+
+    return ota_write_data(&cmd) == OTA_DATA_CONFIRM ? 0 : -1;
+}
+
+static int
+run(uint32_t size, int enc)
+{
+    static ls_ota_config_t cfg;
+    uint32_t padded, addr, len, last, last_len;
+
+    memset(flash, 0xff, sizeof(flash));
+    memset(&ota_env, 0, sizeof(ota_env));
+    ota_env.pConfig = &cfg;
+    ota_env.state = OTA_DATA_WRITE;
+    ota_env.new_flag = enc ? OTA_ENC_MASK : 0;
+    ota_env.base = ZONE_BASE;
+    ota_env.size = size;
+    ota_env.progress_idx = 0xff;
+    write_err = 0;
+
+    /// encrypted packets carry the payload padded to the cipher block
+    padded = size;
+    if (enc)
+        padded = (size - sizeof(ls_ota_header_t) + 15) / 16 * 16 + sizeof(ls_ota_header_t);
+
+    addr = last = last_len = 0;
+    while (addr < padded) {
+        len = (1 + rand() % 300) * 16;
+        if (addr == 0)
+            len += sizeof(ls_ota_header_t);
+        if (len > padded - addr)
+            len = padded - addr;
+
+        if (send(addr, len, size, enc))
+            return -1;
+
+        /// resend the previous packet, or this one again
+        if (rand() % 8 == 0 && send(last, last_len ? last_len : len, size, enc))
+            return -1;
+        if (rand() % 8 == 0 && send(addr, len, size, enc))
+            return -1;
+
+        last = addr;
+        last_len = len;
+        addr += len;
+    }
+
+    if (ota_write_flush() != OTA_SUCCESS)
+        return -1;
+
+    if (write_err) {
+        printf("size %u enc %d: write error %d\n", size, enc, write_err);
+        return -1;
+    }
+    if (memcmp(flash + ZONE_BASE, img, size) != 0) {
+        printf("size %u enc %d: flash mismatch\n", size, enc);
+        return -1;
+    }
+    if (ota_env.done != size) {
+        printf("size %u enc %d: done %u\n", size, enc, ota_env.done);
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    uint32_t i, size;
+    int n;
+
+    srand(1);
+    for (i = 0; i < IMG_MAX; i++)
+        img[i] = rand();
+
+    for (n = 0; n < 200; n++) {
+        size = sizeof(ls_ota_header_t) + 16 + rand() % (IMG_MAX - sizeof(ls_ota_header_t) - 16);
+        if (n % 4 == 0)
+            size &= ~0xffu;
+        if (run(size, n & 1))
+            return 1;
+    }
+
+    printf("ota_write_test: %d images ok\n", n);
+    return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * slip_test.c
+ *
+ *  Host test of SLIP_encode_block() and SLIP_decode_block() against the
+ *  byte API they replace, SLIP_send_frame_data() and SLIP_recv_byte().
+ *  Random frames, frames of only END/ESC bytes and noise between frames
+ *  are encoded both ways, then decoded both ways in random pieces and in
+ *  place. Frames with a broken escape are not compared, the block decoder
+ *  drops the byte while the byte API stays escaping.
+ *
+ *  Then the MB/s of both APIs on random and on all 0xC0 data.
+ *
+ *  make -C test && ./test/slip_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "slip.h"
+
+#define FRAMES      8
+#define FRAME_MAX   (16 * 1024)
+#define STREAM_MAX  (FRAMES * (2 * FRAME_MAX + 8))
+#define BENCH_SIZE  (4 * 1024 * 1024)
+
+static uint8_t frames[FRAMES][FRAME_MAX];
+static uint32_t frame_len[FRAMES];
+static uint8_t tx_byte[STREAM_MAX];
+static uint8_t tx_block[STREAM_MAX];
+static uint8_t rx[STREAM_MAX];
+static uint8_t out[FRAME_MAX];
+
+static void
+make_frame(uint8_t *p, uint32_t len, int kind)
+{
+    static const uint8_t special[] = { 0xC0, 0xDB, 0xDC, 0xDD };
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        if (kind == 0) {
+            p[i] = rand();
+        } else if (kind == 1) {
+            p[i] = special[rand() & 3];
+        } else {
+            p[i] = (rand() % 16) ? 'a' + i % 26 : special[rand() & 3];
+        }
+    }
+}
+
+/* encode the frames with both APIs, noise before each frame, returns the stream size */
+static uint32_t
+encode_both(void)
+{
+    uint32_t pos_byte = 0, pos_block = 0, i, noise;
+    int f;
+
+    for (f = 0; f < FRAMES; f++) {
+        for (noise = rand() % 4; noise > 0; noise--) {
+            tx_byte[pos_byte++] = 0x55;
+            tx_block[pos_block++] = 0x55;
+        }
+
+        SLIP_init((char *)tx_byte + pos_byte, NULL);
+        SLIP_send_frame_delimiter();
+        for (i = 0; i < frame_len[f]; i++) {
+            SLIP_send_frame_data(frames[f][i]);
+        }
+        SLIP_send_frame_delimiter();
+        pos_byte += SLIP_get_tx_size();
+
+        tx_block[pos_block++] = 0xC0;
+        pos_block += SLIP_encode_block(frames[f], frame_len[f], tx_block + pos_block);
+        tx_block[pos_block++] = 0xC0;
+    }
+
+    return (pos_byte == pos_block && !memcmp(tx_byte, tx_block, pos_byte)) ? pos_byte : 0;
+}
+
+/* SLIP_recv_byte() over the stream, every frame has to come out as sent */
+static int
+decode_bytes(const uint8_t *in, uint32_t len)
+{
+    slip_state_t state = SLIP_NO_FRAME;
+    uint32_t i, o = 0;
+    int16_t r;
+    int f = 0;
+
+    for (i = 0; i < len; i++) {
+        r = SLIP_recv_byte((char)in[i], &state);
+        if (r >= 0) {
+            out[o++] = (uint8_t)r;
+        } else if (r == SLIP_FINISHED_FRAME) {
+            if (f >= FRAMES || o != frame_len[f] || memcmp(out, frames[f], o)) {
+                return -1;
+            }
+            f++;
+            o = 0;
+        }
+    }
+    return f == FRAMES ? 0 : -1;
+}
+
+/*
+ * SLIP_decode_block() over the stream in random pieces, into out or in place
+ * at the start of rx, which the output never overtakes
+ */
+static int
+decode_block(uint8_t *in, uint32_t len, int in_place)
+{
+    slip_state_t state = SLIP_NO_FRAME;
+    uint8_t *dst = in_place ? in : out;
+    uint32_t pos = 0, piece, consumed, o = 0;
+    int16_t r;
+    int f = 0;
+
+    while (pos < len) {
+        piece = 1 + rand() % 700;
+        if (piece > len - pos) {
+            piece = len - pos;
+        }
+        r = SLIP_decode_block(in + pos, piece, &consumed, dst, &o, FRAME_MAX, &state);
+        if (consumed > piece || (r != SLIP_FINISHED_FRAME && consumed != piece)) {
+            return -1;
+        }
+        pos += consumed;
+        if (r == SLIP_FINISHED_FRAME) {
+            if (f >= FRAMES || o != frame_len[f] || memcmp(dst, frames[f], o)) {
+                return -1;
+            }
+            f++;
+            o = 0;
+        }
+    }
+    return f == FRAMES ? 0 : -1;
+}
+
+static int
+run_one(int n)
+{
+    uint32_t len;
+    int f;
+
+    for (f = 0; f < FRAMES; f++) {
+        frame_len[f] = rand() % FRAME_MAX;
+        make_frame(frames[f], frame_len[f], (n + f) % 3);
+    }
+
+    len = encode_both();
+    if (len == 0) {
+        printf("%d: encoders differ\n", n);
+        return -1;
+    }
+    if (decode_bytes(tx_byte, len)) {
+        printf("%d: byte decode differs\n", n);
+        return -1;
+    }
+    if (decode_block(tx_byte, len, 0)) {
+        printf("%d: block decode differs\n", n);
+        return -1;
+    }
+    memcpy(rx, tx_byte, len);
+    if (decode_block(rx, len, 1)) {
+        printf("%d: in place block decode differs\n", n);
+        return -1;
+    }
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench(const char *name, const uint8_t *data)
+{
+    static uint8_t enc[2 * BENCH_SIZE], dec[BENCH_SIZE];
+    slip_state_t state;
+    uint32_t i, len, consumed, o;
+    double t, mb = BENCH_SIZE / 1e6;
+    int16_t r;
+
+    t = now();
+    SLIP_init((char *)enc, NULL);
+    for (i = 0; i < BENCH_SIZE; i++) {
+        SLIP_send_frame_data(data[i]);
+    }
+    len = SLIP_get_tx_size();
+    printf("%-8s encode  byte %7.1f MB/s", name, mb / (now() - t));
+
+    t = now();
+    len = SLIP_encode_block(data, BENCH_SIZE, enc);
+    printf("  block %7.1f MB/s\n", mb / (now() - t));
+
+    state = SLIP_FRAME;
+    o = 0;
+    t = now();
+    for (i = 0; i < len; i++) {
+        r = SLIP_recv_byte((char)enc[i], &state);
+        if (r >= 0) {
+            dec[o++] = (uint8_t)r;
+        }
+    }
+    printf("%-8s decode  byte %7.1f MB/s", name, mb / (now() - t));
+
+    state = SLIP_FRAME;
+    o = 0;
+    t = now();
+    SLIP_decode_block(enc, len, &consumed, dec, &o, BENCH_SIZE, &state);
+    printf("  block %7.1f MB/s\n", mb / (now() - t));
+
+    if (o != BENCH_SIZE || memcmp(dec, data, o)) {
+        printf("%-8s round trip differs\n", name);
+    }
+}
+
+int
+main(void)
+{
+    static uint8_t data[BENCH_SIZE];
+    int i, fail = 0;
+
+    srand(1);
+    for (i = 0; i < 100 && !fail; i++) {
+        fail |= run_one(i);
+    }
+    printf("%s\n", fail ? "FAIL" : "ok");
+    if (fail) {
+        return 1;
+    }
+
+    for (i = 0; i < BENCH_SIZE; i++) {
+        data[i] = rand();
+    }
+    bench("random", data);
+    memset(data, 0xC0, BENCH_SIZE);
+    bench("all-0xC0", data);
+
+    return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Driver_CRYPTO.h
+ *
+ *  Host stand-in for the crypto driver header, the test supplies the calls.
+ */
+
+#ifndef TEST_STUB_DRIVER_CRYPTO_H_
+#define TEST_STUB_DRIVER_CRYPTO_H_
+
+#include <stdint.h>
+
+#define CSK_DRIVER_OK                   0
+#define CSK_POWER_OFF                   0
+#define CSK_POWER_FULL                  2
+#define CSK_CRYPTO_HW_AES_SHA           0
+#define CSK_CRYPTO_SET_AES_MODE         1
+#define CSK_CRYPTO_AES_MODE_CBC         1
+#define CSK_CRYPTO_SET_AES_KEY_SIZE_256 2
+#define CSK_CRYPTO_AES_KEY_MODE_EFUSE1  3
+#define CSK_CRYPTO_SET_AES_IV           4
+#define CSK_CRYPTO_SET_AES_LENGTHS      5
+
+int32_t CRYPTO_PowerControl(void *handler, int32_t hw, int32_t state);
+int32_t CRYPTO_Control(void *handler, uint32_t control, uint32_t arg);
+int32_t CRYPTO_AES_Decrypt_Start(void *handler, const uint32_t *src, uint32_t len, uint32_t *dst);
+int32_t CRYPTO_AES_Wait(void *handler);
+int32_t CRYPTO_Verify_Flash_Signature(void *handler, const void *hdr, int32_t mode);
+
+#endif /* TEST_STUB_DRIVER_CRYPTO_H_ */
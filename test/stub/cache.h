@@ -0,0 +1,12 @@
+/*
+ * cache.h
+ *
+ *  Host stand-in for the cache header.
+ */
+
+#ifndef TEST_STUB_CACHE_H_
+#define TEST_STUB_CACHE_H_
+
+void HAL_InvalidateDCache(void);
+
+#endif /* TEST_STUB_CACHE_H_ */
@@ -0,0 +1,27 @@
+/*
+ * chip.h
+ *
+ *  Host stand-in for the chip header, only what ota/ota.c touches.
+ */
+
+#ifndef TEST_STUB_CHIP_H_
+#define TEST_STUB_CHIP_H_
+
+#include <stdint.h>
+
+typedef struct {
+    struct {
+        struct {
+            uint32_t CIPHER_EN_REGION_A : 1;
+            uint32_t CIPHER_TGT_SLV_SEL : 1;
+        } bit;
+    } REG_CIPHER_CTRL3;
+} sysctrl_t;
+
+extern sysctrl_t *IP_SYSCTRL;
+
+#define CMN_FLASH_REGION    0x18000000
+#define CP_CIPHER_REGION_A  0x08000000
+#define FLASH_ENC_ALL       0
+
+#endif /* TEST_STUB_CHIP_H_ */
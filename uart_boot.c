@@ -14,15 +14,34 @@
 #define  DEFAULT_BAUD_RATE  115200
 
 extern uint32_t s_mem_cpy_len;
+extern flash_prog_t flash_prog;
+extern uart_buf_t ub;
 
 PROCESS(uart_boot_process, "uart boot process");
 void* UART_Handler = NULL;
 uint32_t cur_baud_rate = DEFAULT_BAUD_RATE, nxt_baud_rate = DEFAULT_BAUD_RATE;
 volatile int32_t usart_tx_event_complete = 0;
+uint32_t esp_sync_caps = 0;
+static int32_t uart_tx_pending = 0;
 static int32_t uart_initialized = 0;
 static uint32_t uart_time_out_acc = 0;
 static volatile uint32_t uart_time_out_max = 100;
+// ms without a new ack before ESP_READ_FLASH gives up, a 4k packet takes up to ~0.7s at 115200
+static volatile uint32_t read_flash_time_out = 3000;
+// no event comes while the host is silent and the ack count is 0, this one ends the wait
+static struct etimer read_flash_timer;
 
+// wait for the tx fifo to drain and the last character to leave the shift register
+static void uart_tx_flush()
+{
+    while(IP_UART0->REG_STATUS.bit.TX_FIFO_SPACE < 16)
+        ;
+
+    // 10 bits per character at the current baud rate, rounded up
+    clock_delay_usec((10 * 1000000 + cur_baud_rate - 1) / cur_baud_rate);
+}
+
+// only for the responses which must be on the wire before the uart is touched
 static int32_t UART_Send_Polling(void* handler, uint8_t *buf, uint32_t len)
 {
     int i;
@@ -32,14 +51,7 @@ static int32_t UART_Send_Polling(void* handler, uint8_t *buf, uint32_t len)
             ;
     }
 
-    while(IP_UART0->REG_STATUS.bit.TX_FIFO_SPACE < 16)
-        ;
-
-    // delay 10us/bit * 9 for the last UART data out
-    int n = 24 * 10 * 9;
-    while(--n) {
-        __NOP();
-    }
+    uart_tx_flush();
 
     return 0;
 }
@@ -82,6 +94,7 @@ void UART_EventCallback(uint32_t event, void* workspace)
     switch(event) {
     case CSK_UART_EVENT_SEND_COMPLETE:
         usart_tx_event_complete = event;
+        process_post(&uart_boot_process,  PROCESS_EVENT_UART_TXD, NULL);
         break;
     case CSK_UART_EVENT_RX_TIMEOUT:
         usart_rx_event_complete = event;
@@ -150,11 +163,52 @@ int32_t uart_wait_tx_rdy()
     return 0;
 }
 
+// response by DMA, buf must not be touched before UART_TX_WAIT() returns
+static void uart_send_async(uint8_t *buf, uint32_t len)
+{
+    usart_tx_event_complete = 0;
+    uart_tx_pending = 1;
+    if(UART_Send(UART_Handler, buf, len) != CSK_DRIVER_OK) {
+        // fall back so that the host still gets its response
+        UART_Send_Polling(UART_Handler, buf, len);
+        uart_tx_pending = 0;
+    }
+}
+
+// yield in uart_boot_process until the dma released the last async response,
+// PROCESS_EVENT_UART_TXD wakes it up
+#define UART_TX_WAIT()                                          \
+    while(uart_tx_pending && usart_tx_event_complete == 0) {    \
+        PROCESS_WAIT_EVENT();                                   \
+        if(ev == PROCESS_EVENT_PROG_ERR) {                      \
+            error = ESP_FAILED_SPI_OP;                          \
+        }                                                       \
+    }                                                           \
+    uart_tx_pending = 0
+
+// switch reception to the other rx buffer, the current one keeps the decoded frame
+static uint8_t *uart_rx_buf_swap(uint8_t *cur)
+{
+    ub.reading_buf = (cur == (uint8_t *)SLIP_RX_BUF) ? (uint8_t *)SLIP_RX_BUF2 : (uint8_t *)SLIP_RX_BUF;
+    ub.read = 0;
+    ub.scan = 0;
+    ub.state = SLIP_NO_FRAME;
+    return ub.reading_buf;
+}
+
+static int32_t uart_is_data_cmd(int32_t cmd_id)
+{
+    return (cmd_id == ESP_FLASH_DATA || cmd_id == ESP_FLASH_DEFLATED_DATA || cmd_id == ESP_SD_DATA);
+}
+
 PROCESS_THREAD(uart_boot_process, ev, data)
 {
-    static int32_t n = 0, cmd_id, rdy, error = 0;
+    static int32_t n = 0, cmd_id, rdy, error = 0, acked = 0, tx_idx;
+    static uint8_t *tx_buf;
+    static uint32_t tick_ack, tick_stall, tick_wait;
     static uint32_t verify_header_status;
     static uint8_t *cmd = (uint8_t *)SLIP_RX_BUF;
+    static uint8_t *rsp = (uint8_t *)SLIP_TX_BUF;
 
     PROCESS_BEGIN();
 
@@ -183,10 +237,8 @@ PROCESS_THREAD(uart_boot_process, ev, data)
         	n = 1;
         	continue;
         }
-        ub_state_save();
         if (uart_receive_bytes(cmd, n)) {
             BOOT_LOG("... UART RX TIMEOUT or REACH MAX, %s - %d\n", __func__, __LINE__);
-            extern uart_buf_t ub;
             if(ub.read < 4) {
                 BOOT_LOG("... UART RX - ub.read %d bytes\n", ub.read);
                 goto UART_PROCESS_TIMEOUT;
@@ -223,44 +275,70 @@ UART_PROCESS_TIMEOUT:
                 goto UART_PROCESS_ERROR;
             }
 
-            // keep receiving data
-            ub_state_recovery();
+            // keep receiving data, the decoded part of the frame is kept
             continue;
 
 UART_PROCESS_ERROR:
 			BOOT_LOG("... UART PROCESS ERROR, send back resp with len %d\n",n);
 			UART_Control(UART_Handler, CSK_UART_ABORT_RECEIVE, 1);
+			UART_TX_WAIT();
 
             if(ub.read < 2) {
                 BOOT_LOG("... UART PROCESS ERROR- ub.read %d bytes\n", ub.read);
-                cmd[2] = 0xFF; // set to unkown cmd if ub.read < 2
+                rsp[2] = 0xFF; // set to unkown cmd if ub.read < 2
+            } else {
+                rsp[2] = cmd[1]; // keep the command byte of the decoded frame
             }
 			n = 0;
 			ub.read = 0;
+			ub.scan = 0;
 			ub.state = 0;
 
-			cmd[0] = 0xC0; // start byte
-			cmd[1] = 0x01; // direction byte
-            // cmd[2] = cmd[2]; // keep the command byte
-            cmd[3] = 0x02; // length
-            cmd[4] = 0x00; // length
-            cmd[5] = 0x00; // reserved
-            cmd[6] = 0x00; // reserved
-            cmd[7] = 0x00; // reserved
-            cmd[8] = 0x00; // reserved
-            cmd[9] = (uint8_t)error; // status
-            cmd[10] = 0x01; // error
-            cmd[11] = 0xC0; // end byte
-			UART_Send_Polling(UART_Handler, cmd, 12);
+			rsp[0] = 0xC0; // start byte
+			rsp[1] = 0x01; // direction byte
+            rsp[3] = 0x02; // length
+            rsp[4] = 0x00; // length
+            rsp[5] = 0x00; // reserved
+            rsp[6] = 0x00; // reserved
+            rsp[7] = 0x00; // reserved
+            rsp[8] = 0x00; // reserved
+            rsp[9] = (uint8_t)error; // status
+            rsp[10] = 0x01; // error
+            rsp[11] = 0xC0; // end byte
+			uart_send_async(rsp, 12);
             error = 0;  // clear error flag
-			memset(cmd, 0, MAX_WRITE_BLOCK);
 			continue;
         } else {
             BOOT_LOG("\nrx->\n");
             //get a complete package, deal it
             UART_Control(UART_Handler, CSK_UART_ABORT_RECEIVE, 1);
+            UART_TX_WAIT();
+
+            // a new download resets the ring and the erase front, the previous one's
+            // blocks and look-ahead erase must be done with them first
+            if(ub.reading_buf[1] == ESP_FLASH_BEGIN || ub.reading_buf[1] == ESP_FLASH_DEFLATED_BEGIN) {
+                while(flash_prog_in_process()) {
+                    BOOT_LOG("begin- wait ->\n");
+                    PROCESS_WAIT_EVENT();
+                }
+            }
 
-            cmd_id = do_cmd(cmd, &n, COMM_TYPE_UART);
+            cmd_id = do_cmd(rsp, &n, COMM_TYPE_UART);
+
+            if((esp_sync_caps & ESP_SYNC_CAP_WINDOW) && uart_is_data_cmd(cmd_id)) {
+                // ack before program: the payload stays in this rx buffer until it is
+                // copied to the ring, the next frame is received into the other one meanwhile
+                if(error) {
+                    set_resp_error(rsp, error, COMM_TYPE_UART);
+                    error = 0;  // clear error flag
+                }
+                cmd = uart_rx_buf_swap(cmd);
+                uart_time_out_acc = 0;
+                UART_Receive(UART_Handler, cmd, MAX_WRITE_BLOCK);
+                BOOT_LOG("ack resp %d with len %d\n", cmd_id, n);
+                uart_send_async(rsp, n);
+                acked = 1;
+            }
 
             if(cmd_id == ESP_MEM_END) {
                 extern int8_t* s_mem_offset;
@@ -269,31 +347,27 @@ UART_PROCESS_ERROR:
                 verify_header_status = 0; //header_verify((uint8_t *)ap_base);
 				usart_tx_event_complete = 0;
 				BOOT_LOG("send back for baud rate change\n");
-				UART_Send_Polling(UART_Handler, cmd, n);
-//                    UART_Send(UART_Handler, cmd, n);
+				UART_Send_Polling(UART_Handler, rsp, n);
+//                    UART_Send(UART_Handler, rsp, n);
 //                    uart_wait_tx_rdy();
 				run_image((uint8_t *)ap_base);
 
-				set_resp_error(cmd, verify_header_status, COMM_TYPE_UART); //ESP_CMD_NOT_IMPLEMENTED
+				set_resp_error(rsp, verify_header_status, COMM_TYPE_UART); //ESP_CMD_NOT_IMPLEMENTED
             } else if(cmd_id == ESP_SET_BAUD) {
                 if(cur_baud_rate != nxt_baud_rate) {
                     usart_tx_event_complete = 0;
-//                    UART_Send(UART_Handler, cmd, n);
-                    UART_Send_Polling(UART_Handler, cmd, n);
+//                    UART_Send(UART_Handler, rsp, n);
+                    // the response must be out at the old baud rate, UART_Send_Polling
+                    // returns once the last character left the shift register
+                    UART_Send_Polling(UART_Handler, rsp, n);
                     n = 0;
-//                    uart_wait_tx_rdy();
-                    uint32_t tick_curr = SysTick_Value();
-                    // delay ~2ms, 12bytes transmit needs ~1ms
-                    while((SysTick_Value() - tick_curr) < 2)
-                        ;
                     // change baud rate
                     BOOT_LOG("change baud rate to %d\n", nxt_baud_rate);
                     cur_baud_rate = nxt_baud_rate;
                     uart_dev_init(cur_baud_rate);
-                    memset(cmd, 0, MAX_WRITE_BLOCK);
                     continue;
                 }
-            } else if(cmd_id == ESP_FLASH_END) {
+            } else if(cmd_id == ESP_FLASH_END || cmd_id == ESP_FLASH_DEFLATED_END) {
                 do {
                     rdy = flash_prog_in_process();
                     BOOT_LOG("end- %d ->\n", rdy);
@@ -305,12 +379,35 @@ UART_PROCESS_ERROR:
                         BOOT_LOG("flash program in process\n");
                     }
                 } while(rdy);
+                // the report covers the whole download only now, and set_resp_error()
+                // can't patch a frame with escaped bytes in the value
+                n = flash_end_resp(rsp, cmd_id, error);
+                error = 0;  // clear error flag
             } else if(cmd_id == ESP_FLASH_DATA) {
                 while(s_mem_cpy_len) {  // if the value is zero, do not need copy
                     int32_t len = flash_mem_cpy();
                     if(len == 0) {  // no free buffer to copy
                         BOOT_LOG("wait->\n");
+                        tick_stall = SysTick_Value();
+                        PROCESS_WAIT_EVENT();
+                        flash_prog.prog_stall += SysTick_Value() - tick_stall;
+                        if(ev == PROCESS_EVENT_PROG_ERR) {
+                            error = ESP_FAILED_SPI_OP;  // set error flag
+                        }
+                    }
+                }
+            } else if(cmd_id == ESP_FLASH_DEFLATED_DATA) {
+                while(flash_inflate_pending()) {
+                    int32_t ret = flash_inflate();
+                    if(ret < 0) {
+                        error = ESP_INFLATE_ERROR;  // set error flag
+                        break;
+                    }
+                    if(ret == 0) {  // no free buffer to inflate into
+                        BOOT_LOG("wait->\n");
+                        tick_stall = SysTick_Value();
                         PROCESS_WAIT_EVENT();
+                        flash_prog.prog_stall += SysTick_Value() - tick_stall;
                         if(ev == PROCESS_EVENT_PROG_ERR) {
                             error = ESP_FAILED_SPI_OP;  // set error flag
                         }
@@ -349,19 +446,73 @@ UART_PROCESS_ERROR:
                         BOOT_LOG("sd program in process\n");
                     }
                 } while(rdy);
-            } 
+            } else if(cmd_id == ESP_READ_FLASH) {
+                // the response goes first, then the data packets, the host acks each packet
+                // with the number of bytes received so far, the md5 of all data ends it
+                uart_send_async(rsp, n);
+                UART_Receive(UART_Handler, cmd, MAX_WRITE_BLOCK);
+                tick_ack = SysTick_Value();
+                tx_idx = 0;
+                while((rdy = read_flash_ack(cmd, UART_GetRxCount(UART_Handler))) != 1) {
+                    if(rdy == 0) {
+                        tick_ack = SysTick_Value();
+                    }
+                    tx_buf = (uint8_t *)READ_FLASH_TX_BUF + tx_idx * READ_FLASH_TX_BUF_SIZE;
+                    n = read_flash_packet(tx_buf);
+                    if(n) {
+                        // encoded while the other buffer was still going out
+                        UART_TX_WAIT();
+                        uart_send_async(tx_buf, n);
+                        tx_idx ^= 1;
+                    } else if(read_flash_rx_rearm()) {
+                        // nothing in flight, restart the acks at the head of the rx buffer
+                        UART_Control(UART_Handler, CSK_UART_ABORT_RECEIVE, 1);
+                        UART_Receive(UART_Handler, cmd, MAX_WRITE_BLOCK);
+                    } else {
+                        // wait for acks, UART_Rx_Timeout_Process() posts while the rx count stalls,
+                        // the etimer fires for the rest of the timeout if nothing arrives at all
+                        tick_wait = SysTick_Value() - tick_ack;
+                        if(tick_wait >= read_flash_time_out) {
+                            BOOT_LOG("read flash- ack timeout\n");
+                            break;
+                        }
+                        etimer_set(&read_flash_timer, ((read_flash_time_out - tick_wait) * CLOCK_SECOND + 999) / 1000 + 1);
+                        PROCESS_WAIT_EVENT();
+                        etimer_stop(&read_flash_timer);
+                    }
+                }
+                if(rdy == 1) {
+                    tx_buf = (uint8_t *)READ_FLASH_TX_BUF + tx_idx * READ_FLASH_TX_BUF_SIZE;
+                    n = read_flash_digest(tx_buf);
+                    UART_TX_WAIT();
+                    uart_send_async(tx_buf, n);
+                }
+                // the status went with the response already, start over with the next command
+                UART_Control(UART_Handler, CSK_UART_ABORT_RECEIVE, 1);
+                ub.read = 0;
+                ub.scan = 0;
+                ub.state = SLIP_NO_FRAME;
+                error = 0;
+                n = 0;
+                continue;
+            }
+
+            if(acked) {
+                // response is out and rx is armed already, errors go with the next response
+                acked = 0;
+                n = 1;
+                continue;
+            }
 
             if(error) {
                 BOOT_LOG("error- %d ->\n", error);
-                set_resp_error(cmd, error, COMM_TYPE_UART);
+                set_resp_error(rsp, error, COMM_TYPE_UART);
                 error = 0;  // clear error flag
             }
-            //send a response
-//            UART_Send(UART_Handler, cmd, n);
+            //send a response, it drains while the next frame is received
             BOOT_LOG("send back resp %d with len %d\n", cmd_id, n);
-            UART_Send_Polling(UART_Handler, cmd, n);
-            //reset n for next rx frame
-            memset(cmd, 0, MAX_WRITE_BLOCK);
+            uart_send_async(rsp, n);
+            //reset n for next rx frame, no need to clear cmd as frames are decoded by position
             n = 0;
         }
     }